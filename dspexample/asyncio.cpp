@@ -0,0 +1,266 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   asyncio.cpp
+ *         Asynchronous file reads and writes
+ * \author Pablo Alvarado
+ * \date   2011.10.22
+ *
+ * $Id: asyncio.cpp $
+ */
+
+#include "asyncio.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#undef _DSP_DEBUG
+#define _DSP_DEBUG
+
+#ifdef _DSP_DEBUG
+#define _debug(x) std::cerr << x
+#include <iostream>
+#else
+#define _debug(x)
+#endif
+
+asyncIO& asyncIO::instance() {
+  static asyncIO io;
+  return io;
+}
+
+asyncIO::asyncIO() : ringOk_(false),registered_(false),memory_(0) {
+  void* mem=0;
+  if (posix_memalign(&mem,4096,size_t(Buffers)*BufferSize)==0) {
+    memory_=static_cast<char*>(mem);
+    for (int i=Buffers-1;i>=0;--i) {
+      free_.push_back(i);
+    }
+  }
+
+#ifdef HAVE_LIBURING
+  reaper_=0;
+  if (io_uring_queue_init(Depth,&ring_,0)==0) {
+    ringOk_=true;
+
+    // the pool is registered once, so that the kernel does not need to
+    // map the buffers on each transfer
+    if (memory_!=0) {
+      iovec iov[Buffers];
+      for (int i=0;i<Buffers;++i) {
+        iov[i].iov_base=memory_+size_t(i)*BufferSize;
+        iov[i].iov_len=BufferSize;
+      }
+      registered_=(io_uring_register_buffers(&ring_,iov,Buffers)==0);
+      if (!registered_) {
+        _debug("asyncIO: buffers could not be registered" << std::endl);
+      }
+    }
+
+    reaper_=new reaper(this);
+    reaper_->start();
+    _debug("asyncIO: using io_uring" << std::endl);
+  }
+#endif
+
+  if (!ringOk_) {
+    pool_.setMaxThreadCount(Workers);
+    _debug("asyncIO: using " << int(Workers) << " threads" << std::endl);
+  }
+}
+
+asyncIO::~asyncIO() {
+#ifdef HAVE_LIBURING
+  if (ringOk_) {
+    // a request without data stops the reaper
+    lock_.lock();
+    io_uring_sqe* sqe=io_uring_get_sqe(&ring_);
+    while (sqe==0) {
+      io_uring_submit(&ring_);
+      sqe=io_uring_get_sqe(&ring_);
+    }
+    io_uring_prep_nop(sqe);
+    io_uring_sqe_set_data(sqe,0);
+    io_uring_submit(&ring_);
+    lock_.unlock();
+
+    reaper_->wait();
+    delete reaper_;
+    io_uring_queue_exit(&ring_);
+  }
+#endif
+  pool_.waitForDone();
+  free(memory_);
+}
+
+void asyncIO::queue(request& r) {
+  r.state.store(Pending);
+
+  lock_.lock();
+#ifdef HAVE_LIBURING
+  if (ringOk_) {
+    io_uring_sqe* sqe=io_uring_get_sqe(&ring_);
+    if (sqe==0) {
+      // the submission queue is full: send what is there
+      io_uring_submit(&ring_);
+      sqe=io_uring_get_sqe(&ring_);
+    }
+    if (sqe!=0) {
+      if (registered_ && (r.bufferIndex>=0)) {
+        if (r.write) {
+          io_uring_prep_write_fixed(sqe,r.fd,r.buffer,r.size,r.offset,
+                                    r.bufferIndex);
+        } else {
+          io_uring_prep_read_fixed(sqe,r.fd,r.buffer,r.size,r.offset,
+                                   r.bufferIndex);
+        }
+      } else {
+        if (r.write) {
+          io_uring_prep_write(sqe,r.fd,r.buffer,r.size,r.offset);
+        } else {
+          io_uring_prep_read(sqe,r.fd,r.buffer,r.size,r.offset);
+        }
+      }
+      io_uring_sqe_set_data(sqe,&r);
+      lock_.unlock();
+      return;
+    }
+  }
+#endif
+  queued_.push_back(&r);
+  lock_.unlock();
+}
+
+void asyncIO::submit() {
+  lock_.lock();
+#ifdef HAVE_LIBURING
+  if (ringOk_) {
+    io_uring_submit(&ring_);
+  }
+#endif
+  // without ring (or with a ring too busy to take them)
+  for (std::vector<request*>::iterator it=queued_.begin();
+       it!=queued_.end();
+       ++it) {
+    pool_.start(new job(this,*it));
+  }
+  queued_.clear();
+  lock_.unlock();
+}
+
+void asyncIO::wait(request& r) {
+  if (ready(r)) {
+    return;
+  }
+  doneLock_.lock();
+  while (!ready(r)) {
+    doneCond_.wait(&doneLock_);
+  }
+  doneLock_.unlock();
+}
+
+bool asyncIO::ready(const request& r) {
+  return r.state.load()!=Pending;
+}
+
+void asyncIO::finish(request& r,int result) {
+  r.result=result;
+  doneLock_.lock();
+  r.state.store(Done);
+  doneCond_.wakeAll();
+  doneLock_.unlock();
+}
+
+int asyncIO::transfer(request& r) {
+  int done=0;
+  while (done<r.size) {
+    const ssize_t n = r.write ?
+      pwrite(r.fd,r.buffer+done,r.size-done,r.offset+done) :
+      pread(r.fd,r.buffer+done,r.size-done,r.offset+done);
+    if (n<0) {
+      if (errno==EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+    if (n==0) {
+      break; // end of file
+    }
+    done+=static_cast<int>(n);
+  }
+  return done;
+}
+
+void asyncIO::job::run() {
+  io_->finish(*r_,transfer(*r_));
+}
+
+#ifdef HAVE_LIBURING
+void asyncIO::reaper::run() {
+  io_->reap();
+}
+
+void asyncIO::reap() {
+  for (;;) {
+    io_uring_cqe* cqe=0;
+    if (io_uring_wait_cqe(&ring_,&cqe)!=0) {
+      continue;
+    }
+    request* r=static_cast<request*>(io_uring_cqe_get_data(cqe));
+    const int res=cqe->res;
+    io_uring_cqe_seen(&ring_,cqe);
+
+    if (r==0) {
+      return; // stop marker
+    }
+
+    finish(*r,res);
+  }
+}
+#endif
+
+int asyncIO::acquireBuffer() {
+  lock_.lock();
+  int index=-1;
+  if (!free_.empty()) {
+    index=free_.back();
+    free_.pop_back();
+  }
+  lock_.unlock();
+  return index;
+}
+
+void asyncIO::releaseBuffer(int index) {
+  if (index<0) {
+    return;
+  }
+  lock_.lock();
+  free_.push_back(index);
+  lock_.unlock();
+}
+
+char* asyncIO::buffer(int index) const {
+  return memory_+size_t(index)*BufferSize;
+}
+
+bool asyncIO::usingRing() const {
+  return ringOk_;
+}
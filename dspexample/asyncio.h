@@ -0,0 +1,260 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   asyncio.h
+ *         Asynchronous file reads and writes
+ * \author Pablo Alvarado
+ * \date   2011.10.22
+ *
+ * $Id: asyncio.h $
+ */
+
+#ifndef ASYNCIO_H
+#define ASYNCIO_H
+
+#include <atomic>
+#include <vector>
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <QThreadPool>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/**
+ * Asynchronous I/O layer shared by all file streams.
+ *
+ * Reads and writes are described by request objects, which are queued
+ * and then sent in one batch with submit().  The thread that queued them
+ * continues, and may later wait() for each one.
+ *
+ * If the program is built with HAVE_LIBURING and the kernel supports it,
+ * the requests go through an io_uring: a whole batch costs one system call
+ * and the transfers into the buffers of the pool (see acquireBuffer()) use
+ * pre-registered memory.  One thread reaps all completions.  Otherwise,
+ * a small pool of threads executes the requests with pread() and pwrite().
+ *
+ * All methods are thread-safe.
+ */
+class asyncIO {
+public:
+  /**
+   * A read or write of a block of a file
+   */
+  struct request {
+    request() : fd(-1),buffer(0),bufferIndex(-1),size(0),offset(0),
+                write(false),result(0),state(Idle) {
+    }
+
+    int fd;           /**< file descriptor */
+    char* buffer;     /**< data */
+    int bufferIndex;  /**< index of buffer in the pool, or -1 */
+    int size;         /**< bytes to transfer */
+    long long offset; /**< position in the file */
+    bool write;       /**< write instead of read */
+
+    /**
+     * Transferred bytes (less than size at the end of a file), or a
+     * negative errno value.  Only valid once the request is done.
+     */
+    int result;
+
+    /**
+     * Idle, Pending or Done
+     */
+    std::atomic<int> state;
+  };
+
+  /**
+   * States of a request
+   */
+  enum {
+    Idle,
+    Pending,
+    Done
+  };
+
+  /**
+   * Some constants
+   */
+  enum {
+    BufferSize=65536, /**< size of each buffer in the pool */
+    Buffers=64,       /**< number of buffers in the pool */
+    Depth=128,        /**< maximum number of requests in flight */
+    Workers=4         /**< threads used without io_uring */
+  };
+
+  /**
+   * The I/O layer used by everybody
+   */
+  static asyncIO& instance();
+
+  /**
+   * Destructor.  All requests must be done.
+   */
+  ~asyncIO();
+
+  /**
+   * Prepare a request to be sent with the next submit()
+   */
+  void queue(request& r);
+
+  /**
+   * Send all queued requests
+   */
+  void submit();
+
+  /**
+   * Block until the given request is done.  Idle requests return at once.
+   */
+  void wait(request& r);
+
+  /**
+   * True if the request is not pending
+   */
+  static bool ready(const request& r);
+
+  /**
+   * Take a buffer of BufferSize bytes from the pool.
+   *
+   * @return index of the buffer, or -1 if all are in use
+   */
+  int acquireBuffer();
+
+  /**
+   * Return a buffer to the pool
+   */
+  void releaseBuffer(int index);
+
+  /**
+   * Memory of the given buffer of the pool
+   */
+  char* buffer(int index) const;
+
+  /**
+   * True if the requests go through an io_uring
+   */
+  bool usingRing() const;
+
+protected:
+  /**
+   * Only construct through instance()
+   */
+  asyncIO();
+
+  /**
+   * Mark a request as done and wake up whoever waits for it
+   */
+  void finish(request& r,int result);
+
+  /**
+   * Execute a request synchronously (thread pool)
+   */
+  static int transfer(request& r);
+
+  /**
+   * Job of the thread pool
+   */
+  class job : public QRunnable {
+  public:
+    job(asyncIO* io,request* r) : io_(io),r_(r) {}
+    virtual void run();
+  protected:
+    asyncIO* io_;
+    request* r_;
+  };
+
+#ifdef HAVE_LIBURING
+  /**
+   * Thread reaping the completions of the ring
+   */
+  class reaper : public QThread {
+  public:
+    reaper(asyncIO* io) : io_(io) {}
+    virtual void run();
+  protected:
+    asyncIO* io_;
+  };
+
+  /**
+   * Reap completions until the stop marker is found (reaper thread)
+   */
+  void reap();
+
+  /**
+   * The ring
+   */
+  io_uring ring_;
+
+  /**
+   * The completion thread
+   */
+  reaper* reaper_;
+#endif
+
+  /**
+   * The ring could be set up
+   */
+  bool ringOk_;
+
+  /**
+   * The buffers of the pool are registered in the ring
+   */
+  bool registered_;
+
+  /**
+   * Threads used without ring
+   */
+  QThreadPool pool_;
+
+  /**
+   * Requests queued since the last submit() (only used without ring)
+   */
+  std::vector<request*> queued_;
+
+  /**
+   * Memory of all buffers of the pool, page aligned
+   */
+  char* memory_;
+
+  /**
+   * Buffers of the pool not in use
+   */
+  std::vector<int> free_;
+
+  /**
+   * Protects the submission side, queued_ and free_
+   */
+  QMutex lock_;
+
+  /**
+   * Protects the completion of requests, for doneCond_
+   */
+  QMutex doneLock_;
+
+  /**
+   * Signaled each time a request is done
+   */
+  QWaitCondition doneCond_;
+};
+
+#endif // ASYNCIO_H
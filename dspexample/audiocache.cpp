@@ -0,0 +1,119 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   audiocache.cpp
+ *         Decoded audio kept in memory for repeated playback
+ * \author Pablo Alvarado
+ * \date   2011.10.24
+ *
+ * $Id: audiocache.cpp $
+ */
+
+#include "audiocache.h"
+
+audioCache& audioCache::instance() {
+  static audioCache cache;
+  return cache;
+}
+
+audioCache::audioCache() : size_(0),budget_(DefaultBudget) {
+}
+
+long long audioCache::bytes(const entry& e) {
+  return static_cast<long long>(e.samples.size())*sizeof(float);
+}
+
+std::shared_ptr<const audioCache::entry>
+audioCache::find(const std::string& name,long long modified,int sampleRate) {
+  std::shared_ptr<const entry> found;
+  lock_.lock();
+
+  // only a handful of files fit, so a linear search is enough
+  std::list<std::shared_ptr<const entry> >::iterator it=entries_.begin();
+  while (it!=entries_.end()) {
+    const entry& e=**it;
+    if ((e.name!=name) || (e.sampleRate!=sampleRate)) {
+      ++it;
+    } else if (e.modified!=modified) {
+      // the file changed on disk
+      size_-=bytes(e);
+      it=entries_.erase(it);
+    } else {
+      found=*it;
+      entries_.splice(entries_.begin(),entries_,it);
+      break;
+    }
+  }
+
+  lock_.unlock();
+  return found;
+}
+
+void audioCache::insert(const std::shared_ptr<const entry>& e) {
+  const long long b=bytes(*e);
+  lock_.lock();
+  if (b>budget_) {
+    lock_.unlock();
+    return;
+  }
+
+  // the same file may have been decoded twice meanwhile
+  std::list<std::shared_ptr<const entry> >::iterator it=entries_.begin();
+  while (it!=entries_.end()) {
+    if (((*it)->name==e->name) && ((*it)->sampleRate==e->sampleRate)) {
+      size_-=bytes(**it);
+      it=entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  evict(b);
+  entries_.push_front(e);
+  size_+=b;
+  lock_.unlock();
+}
+
+bool audioCache::fits(long long samples) const {
+  lock_.lock();
+  const bool ok=samples*static_cast<long long>(sizeof(float))<=budget_;
+  lock_.unlock();
+  return ok;
+}
+
+void audioCache::setBudget(long long bytes) {
+  lock_.lock();
+  budget_ = (bytes>0) ? bytes : 0;
+  evict(0);
+  lock_.unlock();
+}
+
+long long audioCache::size() const {
+  lock_.lock();
+  const long long s=size_;
+  lock_.unlock();
+  return s;
+}
+
+void audioCache::evict(long long extra) {
+  while (!entries_.empty() && (size_+extra>budget_)) {
+    size_-=bytes(*entries_.back());
+    entries_.pop_back();
+  }
+}
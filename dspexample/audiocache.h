@@ -0,0 +1,150 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   audiocache.h
+ *         Decoded audio kept in memory for repeated playback
+ * \author Pablo Alvarado
+ * \date   2011.10.24
+ *
+ * $Id: audiocache.h $
+ */
+
+#ifndef AUDIOCACHE_H
+#define AUDIOCACHE_H
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <QMutex>
+
+/**
+ * Cache of whole decoded files.
+ *
+ * Each entry holds the complete signal of a file as audioStream delivers
+ * it: downmixed to mono and at the sample rate of the output.  Entries are
+ * identified by the file name, its modification time and the output sample
+ * rate, so that a file changed on disk or played at another rate is decoded
+ * again.
+ *
+ * The total size of the entries is kept within a budget by dropping the
+ * least recently used ones.  Entries are shared: a stream still playing a
+ * dropped entry keeps it alive until it is closed.
+ *
+ * All methods are thread-safe.
+ */
+class audioCache {
+public:
+  /**
+   * A decoded file
+   */
+  struct entry {
+    std::string name;        /**< file name */
+    long long modified;      /**< modification time, in ns */
+    int sampleRate;          /**< sample rate of samples */
+    int fileSampleRate;      /**< sample rate of the file */
+    int channels;            /**< channels of the file */
+    std::vector<float> samples; /**< mono signal at sampleRate */
+  };
+
+  /**
+   * Some constants
+   */
+  enum {
+    DefaultBudget=256<<20 /**< bytes kept by default */
+  };
+
+  /**
+   * The cache used by everybody
+   */
+  static audioCache& instance();
+
+  /**
+   * Find the entry of a file, and mark it as the most recently used
+   *
+   * Entries of the same file and rate with another modification time are
+   * stale and dropped.
+   *
+   * @return the entry, or an empty pointer if the file is not cached
+   */
+  std::shared_ptr<const entry> find(const std::string& name,
+                                    long long modified,int sampleRate);
+
+  /**
+   * Add an entry as the most recently used one.  Older entries are
+   * dropped until it fits the budget.  Entries larger than the budget are
+   * not kept.
+   */
+  void insert(const std::shared_ptr<const entry>& e);
+
+  /**
+   * True if an entry of the given number of samples fits the budget
+   */
+  bool fits(long long samples) const;
+
+  /**
+   * Set the maximum number of bytes kept.  Zero disables the cache.
+   */
+  void setBudget(long long bytes);
+
+  /**
+   * Bytes currently kept
+   */
+  long long size() const;
+
+protected:
+  /**
+   * Only construct through instance()
+   */
+  audioCache();
+
+  /**
+   * Drop the least recently used entries until extra more bytes fit the
+   * budget (lock_ held)
+   */
+  void evict(long long extra);
+
+  /**
+   * Bytes used by an entry
+   */
+  static long long bytes(const entry& e);
+
+  /**
+   * Entries, the most recently used first
+   */
+  std::list<std::shared_ptr<const entry> > entries_;
+
+  /**
+   * Sum of the bytes of all entries
+   */
+  long long size_;
+
+  /**
+   * Maximum of size_
+   */
+  long long budget_;
+
+  /**
+   * Protects entries_, size_ and budget_
+   */
+  mutable QMutex lock_;
+};
+
+#endif // AUDIOCACHE_H
@@ -0,0 +1,683 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   audiostream.cpp
+ *         Decoding of one audio file for playback
+ * \author Pablo Alvarado
+ * \date   2011.10.20
+ *
+ * $Id: audiostream.cpp $
+ */
+
+#include "audiostream.h"
+#include "simd.h"
+
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+audioStream::audioStream()
+  : map_(0),mapSize_(0),data_(0),dataFrames_(0),blockAlign_(0),
+    sampleBytes_(0),framePos_(0),advised_(0),
+    fd_(-1),fileSize_(0),filePos_(0),file_(0),fileSampleRate_(0),
+    channels_(0),format_(Float32),sampleRate_(0),native_(0),buffer_(0),
+    mono_(0),parallel_(0),frames_(0),pos_(0),phase_(0),expected_(0) {
+}
+
+audioStream::~audioStream() {
+  close();
+}
+
+void audioStream::close() {
+  cached_.reset();
+  record_.reset();
+
+  if (file_!=0) {
+    sf_close(file_);
+    file_=0;
+  }
+  delete parallel_;
+  parallel_=0;
+  delete[] static_cast<char*>(native_);
+  native_=0;
+  delete[] buffer_;
+  buffer_=0;
+  delete[] mono_;
+  mono_=0;
+  frames_=0;
+
+  if (map_!=0) {
+    munmap(map_,mapSize_);
+    map_=0;
+    data_=0;
+  }
+
+  releaseBlocks();
+}
+
+void audioStream::releaseBlocks() {
+  // the blocks in flight still write into their buffers
+  asyncIO& io=asyncIO::instance();
+  for (int i=0;i<Blocks;++i) {
+    io.wait(blocks_[i]);
+    io.releaseBuffer(blocks_[i].bufferIndex);
+    blocks_[i].bufferIndex=-1;
+    blocks_[i].buffer=0;
+    blocks_[i].state.store(asyncIO::Idle);
+  }
+
+  if (fd_>=0) {
+    ::close(fd_);
+    fd_=-1;
+  }
+}
+
+bool audioStream::open(const char* filename,int sampleRate,
+                       std::string& error,int readAhead) {
+  close();
+
+  name_=filename;
+  sampleRate_=sampleRate;
+
+  SF_INFO info;
+  info.format = 0; // this has to be set to zero before calling sf_open
+
+  fd_ = ::open(filename,O_RDONLY);
+  if (fd_<0) {
+    error = std::string("Error opening file ") + filename + ": " +
+            strerror(errno);
+    return false;
+  }
+
+  struct stat st;
+  long long modified=0;
+  fileSize_=0;
+  if (fstat(fd_,&st)==0) {
+    fileSize_=st.st_size;
+    modified=st.st_mtim.tv_sec*1000000000LL+st.st_mtim.tv_nsec;
+  }
+  filePos_ = 0;
+  pos_=0;
+  phase_=0;
+
+  // played before: nothing to decode
+  cached_=audioCache::instance().find(name_,modified,sampleRate_);
+  if (cached_) {
+    ::close(fd_);
+    fd_=-1;
+    fileSampleRate_=cached_->fileSampleRate;
+    channels_=cached_->channels;
+    return true;
+  }
+
+  // uncompressed WAV files need no decoder at all
+  if (openMapped()) {
+    startRecording(dataFrames_,modified);
+    return true;
+  }
+
+  // the blocks read ahead need buffers of the pool
+  asyncIO& io=asyncIO::instance();
+  bool buffers=true;
+  for (int i=0;i<Blocks;++i) {
+    blocks_[i].fd=fd_;
+    blocks_[i].offset=-1;
+    blocks_[i].bufferIndex=io.acquireBuffer();
+    buffers = buffers && (blocks_[i].bufferIndex>=0);
+    if (blocks_[i].bufferIndex>=0) {
+      blocks_[i].buffer=io.buffer(blocks_[i].bufferIndex);
+    }
+  }
+
+  if (buffers) {
+    SF_VIRTUAL_IO vio;
+    vio.get_filelen = &audioStream::fileLength;
+    vio.seek = &audioStream::fileSeek;
+    vio.read = &audioStream::fileRead;
+    vio.write = &audioStream::fileWrite;
+    vio.tell = &audioStream::fileTell;
+    file_ = sf_open_virtual(&vio,SFM_READ,&info,this);
+  } else {
+    // the pool is exhausted: libsndfile reads by itself
+    for (int i=0;i<Blocks;++i) {
+      io.releaseBuffer(blocks_[i].bufferIndex);
+      blocks_[i].bufferIndex=-1;
+      blocks_[i].buffer=0;
+    }
+    ::close(fd_);
+    fd_=-1;
+    file_ = sf_open(filename,SFM_READ,&info);
+  }
+
+  if (file_ == 0) {
+    error = std::string("Error opening file ") + filename + ": " +
+            sf_strerror(0);
+    close();
+    return false;
+  }
+
+  if ((info.channels<1) || (info.samplerate<1)) {
+    error = std::string("Unsupported format in file ") + filename;
+    close();
+    return false;
+  }
+
+  fileSampleRate_=info.samplerate;
+  channels_=info.channels;
+  format_=Float32;
+
+  // long compressed files are decoded by several threads, each one with
+  // its own handle: this one is not needed anymore
+  if (parallelDecoder::suitable(info)) {
+    const long long ahead =
+      static_cast<long long>(readAhead)*fileSampleRate_/sampleRate_;
+    parallel_=new parallelDecoder;
+    if (parallel_->open(filename,info,ahead,error)) {
+      sf_close(file_);
+      file_=0;
+      releaseBlocks();
+    } else {
+      delete parallel_;
+      parallel_=0;
+    }
+  }
+
+  // integer encodings are read as such and converted here.  libsndfile
+  // delivers 24 bit samples left aligned in an int.
+  if (parallel_==0) {
+    switch(info.format & SF_FORMAT_SUBMASK) {
+    case SF_FORMAT_PCM_16:
+      format_=Int16;
+      native_=new char[ChunkFrames*channels_*sizeof(short)];
+      break;
+    case SF_FORMAT_PCM_24:
+    case SF_FORMAT_PCM_32:
+      format_=Int32;
+      native_=new char[ChunkFrames*channels_*sizeof(int)];
+      break;
+    default:
+      break;
+    }
+
+    if (channels_>1) {
+      buffer_ = new float[ChunkFrames*channels_];
+    }
+  }
+  mono_ = new float[ChunkFrames];
+  pos_=0;
+  phase_=0;
+
+  startRecording(info.frames,modified);
+
+  // the first chunk is ready before the stream is needed.  An empty file
+  // is not an error: it just ends at once.
+  decode();
+
+  return true;
+}
+
+bool audioStream::decode() {
+  if (map_!=0) {
+    return decodeMapped();
+  }
+
+  if (parallel_!=0) {
+    frames_=parallel_->read(mono_,ChunkFrames);
+    return frames_>0;
+  }
+
+  frames_=0;
+  if (file_==0) {
+    return false;
+  }
+
+  // mono files need no downmix, and are converted straight into mono_
+  float* const dst = (channels_>1) ? buffer_ : mono_;
+  switch(format_) {
+  case Int16: {
+    short* const src=static_cast<short*>(native_);
+    frames_=static_cast<int>(sf_readf_short(file_,src,ChunkFrames));
+    simd::toFloat(reinterpret_cast<const int16_t*>(src),dst,
+                  frames_*channels_);
+    break;
+  }
+  case Int32: {
+    int* const src=static_cast<int*>(native_);
+    frames_=static_cast<int>(sf_readf_int(file_,src,ChunkFrames));
+    simd::toFloat(reinterpret_cast<const int32_t*>(src),dst,
+                  frames_*channels_);
+    break;
+  }
+  default:
+    frames_=static_cast<int>(sf_readf_float(file_,dst,ChunkFrames));
+    break;
+  }
+  if (frames_<0) {
+    frames_=0;
+  }
+
+  if (channels_>1) {
+    simd::downmix(buffer_,mono_,frames_,channels_);
+  }
+  return frames_>0;
+}
+
+int audioStream::read(float* out,int frames) {
+  if (cached_) {
+    const std::vector<float>& samples=cached_->samples;
+    long long n=static_cast<long long>(samples.size())-pos_;
+    if (n>frames) {
+      n=frames;
+    }
+    if (n<=0) {
+      return 0;
+    }
+    memcpy(out,samples.data()+pos_,n*sizeof(float));
+    pos_+=n;
+    return static_cast<int>(n);
+  }
+
+  const int cnt=resample(out,frames);
+
+  if (record_) {
+    std::vector<float>& samples=record_->samples;
+    samples.insert(samples.end(),out,out+cnt);
+    if (static_cast<long long>(samples.size())>expected_) {
+      // longer than announced by the file: not worth keeping
+      record_.reset();
+    } else if (cnt<frames) {
+      // a file cut short by a read error is not kept either
+      if (static_cast<long long>(samples.size())==expected_) {
+        audioCache::instance().insert(record_);
+      }
+      record_.reset();
+    }
+  }
+
+  return cnt;
+}
+
+void audioStream::startRecording(long long fileFrames,long long modified) {
+  // some formats do not know their length
+  if ((fileFrames<=0) || (fileFrames>(1LL<<40))) {
+    return;
+  }
+
+  // one sample for each step of fileSampleRate_/sampleRate_ file frames
+  // starting before the end
+  expected_=(fileFrames*sampleRate_+fileSampleRate_-1)/fileSampleRate_;
+  if ((expected_<=0) || !audioCache::instance().fits(expected_)) {
+    return;
+  }
+
+  record_=std::make_shared<audioCache::entry>();
+  record_->name=name_;
+  record_->modified=modified;
+  record_->sampleRate=sampleRate_;
+  record_->fileSampleRate=fileSampleRate_;
+  record_->channels=channels_;
+  record_->samples.reserve(expected_);
+}
+
+int audioStream::resample(float* out,int frames) {
+  int i=0;
+
+  if (fileSampleRate_==sampleRate_) {
+    // no rate adaptation: the chunks are copied as they are
+    while (i<frames) {
+      if (pos_>=frames_) {
+        pos_=0;
+        if (!decode()) {
+          frames_=0;
+          return i;
+        }
+      }
+      int n=frames_-pos_;
+      if (n>frames-i) {
+        n=frames-i;
+      }
+      memcpy(out+i,mono_+pos_,n*sizeof(float));
+      pos_+=n;
+      i+=n;
+    }
+    return i;
+  }
+
+  for (;i<frames;++i) {
+    while (pos_>=frames_) {
+      pos_-=frames_;
+      if (!decode()) {
+        pos_=frames_=0;
+        return i;
+      }
+    }
+
+    out[i]=mono_[pos_];
+
+    // step of fileSampleRate_/sampleRate_ file frames
+    phase_+=fileSampleRate_;
+    pos_+=phase_/sampleRate_;
+    phase_%=sampleRate_;
+  }
+  return i;
+}
+
+const std::string& audioStream::name() const {
+  return name_;
+}
+
+int audioStream::fileSampleRate() const {
+  return fileSampleRate_;
+}
+
+int audioStream::channels() const {
+  return channels_;
+}
+
+/*
+ * Little endian fields of the WAV header
+ */
+static inline unsigned int le16(const unsigned char* p) {
+  return p[0] | (p[1]<<8);
+}
+
+static inline unsigned int le32(const unsigned char* p) {
+  return p[0] | (p[1]<<8) | (p[2]<<16) | (unsigned(p[3])<<24);
+}
+
+bool audioStream::openMapped() {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__==__ORDER_BIG_ENDIAN__)
+  // the conversion kernels expect the little endian samples of the file
+  return false;
+#endif
+
+  if (fileSize_<44) {
+    return false;
+  }
+
+  void* map=mmap(0,fileSize_,PROT_READ,MAP_PRIVATE,fd_,0);
+  if (map==MAP_FAILED) {
+    return false;
+  }
+  const unsigned char* p=static_cast<const unsigned char*>(map);
+  const unsigned char* end=p+fileSize_;
+
+  int encoding=-1;
+  int channels=0;
+  int rate=0;
+  int align=0;
+  int bits=0;
+  const unsigned char* data=0;
+  long long dataSize=0;
+
+  if ((memcmp(p,"RIFF",4)==0) && (memcmp(p+8,"WAVE",4)==0)) {
+    // walk through the chunks, which are padded to even sizes.  Offsets
+    // are compared instead of pointers, which must not leave the mapping.
+    long long pos=12;
+    while ((end-p-pos>=8) && (data==0)) {
+      const unsigned char* chunk=p+pos;
+      const long long size=le32(chunk+4);
+      const unsigned char* body=chunk+8;
+      const long long left=end-body;
+      if ((memcmp(chunk,"fmt ",4)==0) && (size>=16) && (left>=16)) {
+        encoding=le16(body);
+        channels=le16(body+2);
+        rate=le32(body+4);
+        align=le16(body+12);
+        bits=le16(body+14);
+        if ((encoding==0xFFFE) && (size>=26) && (left>=26)) {
+          // extensible format: the encoding is in the subformat
+          encoding=le16(body+24);
+        }
+      } else if (memcmp(chunk,"data",4)==0) {
+        data=body;
+        // streamed files may leave the size open
+        dataSize = ((size==0) || (size>left)) ? left : size;
+      }
+      if (size+(size&1)>left) {
+        break; // truncated chunk: nothing follows it
+      }
+      pos+=8+size+(size&1);
+    }
+  }
+
+  // only the plain encodings are read from the mapping
+  sampleFormat format=Int16;
+  bool supported = (data!=0) && (channels>0) && (rate>0);
+  if (supported && (encoding==1)) {
+    switch(bits) {
+    case 8:  format=Unsigned8; break;
+    case 16: format=Int16; break;
+    case 24: format=Int24; break;
+    case 32: format=Int32; break;
+    default: supported=false;
+    }
+  } else if (supported && (encoding==3) && (bits==32)) {
+    format=Float32;
+  } else {
+    supported=false;
+  }
+  supported = supported && (align==channels*(bits/8));
+
+  if (!supported) {
+    munmap(map,fileSize_);
+    return false;
+  }
+
+  map_=map;
+  mapSize_=fileSize_;
+  data_=data;
+  dataFrames_=dataSize/align;
+  blockAlign_=align;
+  sampleBytes_=bits/8;
+  format_=format;
+  fileSampleRate_=rate;
+  channels_=channels;
+  framePos_=0;
+
+  // float samples are downmixed straight from the mapping
+  if ((channels_>1) && (format_!=Float32)) {
+    buffer_ = new float[ChunkFrames*channels_];
+  }
+  mono_ = new float[ChunkFrames];
+  decodeMapped();
+
+  // read once from begin to end: pages behind can be dropped early
+  madvise(map_,mapSize_,MADV_SEQUENTIAL);
+  advised_=data_-p;
+  adviseAhead();
+
+  return true;
+}
+
+void audioStream::adviseAhead() {
+  const long long page=4096;
+  const long long position=(data_-static_cast<unsigned char*>(map_))+
+                           framePos_*blockAlign_;
+  if (position+MapAhead/2<advised_) {
+    return;
+  }
+
+  // the pages of the next MapAhead bytes are read by the kernel while the
+  // ones before are being used
+  const long long from=(advised_/page)*page;
+  long long to=position+MapAhead;
+  if (to>mapSize_) {
+    to=mapSize_;
+  }
+  if (to>from) {
+    madvise(static_cast<char*>(map_)+from,to-from,MADV_WILLNEED);
+  }
+  advised_=to;
+}
+
+bool audioStream::decodeMapped() {
+  long long left=dataFrames_-framePos_;
+  frames_ = (left<ChunkFrames) ? static_cast<int>(left) : int(ChunkFrames);
+  if (frames_<=0) {
+    frames_=0;
+    return false;
+  }
+
+  const unsigned char* src=data_+framePos_*blockAlign_;
+  const int samples=frames_*channels_;
+  float* const dst = (channels_>1) ? buffer_ : mono_;
+
+  switch(format_) {
+  case Unsigned8:
+    for (int i=0;i<samples;++i) {
+      dst[i]=(int(src[i])-128)*(1.0f/128.0f);
+    }
+    break;
+  case Int16:
+    simd::toFloat(reinterpret_cast<const int16_t*>(src),dst,samples);
+    break;
+  case Int24:
+    simd::int24ToFloat(src,dst,samples);
+    break;
+  case Int32:
+    simd::toFloat(reinterpret_cast<const int32_t*>(src),dst,samples);
+    break;
+  case Float32:
+    simd::downmix(reinterpret_cast<const float*>(src),mono_,
+                  frames_,channels_);
+    break;
+  }
+
+  if ((channels_>1) && (format_!=Float32)) {
+    simd::downmix(buffer_,mono_,frames_,channels_);
+  }
+
+  framePos_+=frames_;
+  adviseAhead();
+  return true;
+}
+
+/*
+ * Virtual file for libsndfile
+ */
+sf_count_t audioStream::fileLength(void* stream) {
+  return static_cast<audioStream*>(stream)->fileSize_;
+}
+
+sf_count_t audioStream::fileSeek(sf_count_t offset,int whence,void* stream) {
+  audioStream* s=static_cast<audioStream*>(stream);
+  switch(whence) {
+  case SEEK_CUR:
+    offset+=s->filePos_;
+    break;
+  case SEEK_END:
+    offset+=s->fileSize_;
+    break;
+  default:
+    break;
+  }
+  if ((offset<0) || (offset>s->fileSize_)) {
+    return -1;
+  }
+  s->filePos_=offset;
+  return offset;
+}
+
+sf_count_t audioStream::fileRead(void* ptr,sf_count_t count,void* stream) {
+  return static_cast<audioStream*>(stream)->
+    readBytes(static_cast<char*>(ptr),count);
+}
+
+sf_count_t audioStream::fileWrite(const void*,sf_count_t,void*) {
+  return 0;
+}
+
+sf_count_t audioStream::fileTell(void* stream) {
+  return static_cast<audioStream*>(stream)->filePos_;
+}
+
+sf_count_t audioStream::readBytes(char* ptr,sf_count_t count) {
+  sf_count_t done=0;
+  while ((done<count) && (filePos_<fileSize_)) {
+    const long long index=filePos_/asyncIO::BufferSize;
+    const asyncIO::request& b=fetch(index);
+
+    const int skip=static_cast<int>(filePos_-b.offset);
+    sf_count_t n=b.result-skip;
+    if (n<=0) {
+      break; // read error or file truncated
+    }
+    if (n>count-done) {
+      n=count-done;
+    }
+    memcpy(ptr+done,b.buffer+skip,n);
+    done+=n;
+    filePos_+=n;
+  }
+
+  // keep the disk busy with the blocks that come next
+  prefetch(filePos_/asyncIO::BufferSize);
+
+  return done;
+}
+
+asyncIO::request& audioStream::fetch(long long index) {
+  asyncIO& io=asyncIO::instance();
+  asyncIO::request& b=blocks_[index%Blocks];
+  if (b.offset!=index*asyncIO::BufferSize) {
+    // not requested in advance (e.g. after a seek)
+    request(index);
+    io.submit();
+  }
+  io.wait(b);
+  return b;
+}
+
+void audioStream::prefetch(long long index) {
+  asyncIO& io=asyncIO::instance();
+  bool queued=false;
+  for (int k=1;k<Blocks;++k) {
+    const long long j=index+k;
+    if (j*asyncIO::BufferSize>=fileSize_) {
+      break;
+    }
+    const asyncIO::request& b=blocks_[j%Blocks];
+    if ((b.offset!=j*asyncIO::BufferSize) && asyncIO::ready(b)) {
+      request(j);
+      queued=true;
+    }
+  }
+
+  // all of them in one batch
+  if (queued) {
+    io.submit();
+  }
+}
+
+void audioStream::request(long long index) {
+  asyncIO& io=asyncIO::instance();
+  asyncIO::request& b=blocks_[index%Blocks];
+
+  // a slot still in flight cannot be reused yet
+  io.wait(b);
+
+  b.offset=index*asyncIO::BufferSize;
+  b.size=asyncIO::BufferSize;
+  b.write=false;
+  io.queue(b);
+}
@@ -0,0 +1,363 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   audiostream.h
+ *         Decoding of one audio file for playback
+ * \author Pablo Alvarado
+ * \date   2011.10.20
+ *
+ * $Id: audiostream.h $
+ */
+
+#ifndef AUDIOSTREAM_H
+#define AUDIOSTREAM_H
+
+#include <sndfile.h>
+#include <string>
+
+#include "asyncio.h"
+#include "audiocache.h"
+#include "paralleldecoder.h"
+
+/**
+ * One audio file being played.
+ *
+ * The file is decoded in chunks and delivered as a mono signal (the
+ * average of all channels) at the sample rate of the output.  The rate is
+ * adapted by taking the nearest earlier sample, keeping track of the phase
+ * across chunks and calls, so that any number of frames can be read at a
+ * time.
+ *
+ * open() already decodes the first chunk, so that the stream can be
+ * prepared while another one is being played and then be continued from
+ * at any sample without waiting for the disk.
+ *
+ * The samples are taken in the native format of the file (16, 24 or 32 bit
+ * integers, or float) and converted and downmixed a chunk at a time by the
+ * vectorized kernels of simd, instead of by the generic per-sample
+ * conversion of libsndfile.
+ *
+ * Uncompressed WAV files (integer PCM or float samples) are memory mapped
+ * instead: the chunks are converted straight from the mapping, without any
+ * intermediate copy or system call.  The kernel is told that the mapping is
+ * read sequentially, and the pages ahead are requested in advance.
+ *
+ * Files played to the end are kept in the audioCache, if they fit its
+ * budget.  Opening a cached file again takes no decoding at all: the
+ * signal is copied from the cache.
+ *
+ * For all other files libsndfile does not read the file itself: its reads
+ * are served from blocks requested ahead of time through asyncIO, so that
+ * decoding seldom waits for the disk.  If no buffers are left in the
+ * asyncIO pool, the file is read by libsndfile directly.
+ *
+ * Long FLAC and Ogg Vorbis files are handed to a parallelDecoder instead,
+ * which decodes several chunks of them at once.
+ */
+class audioStream {
+public:
+  /**
+   * Constructor
+   */
+  audioStream();
+
+  /**
+   * Destructor.  Closes the file.
+   */
+  ~audioStream();
+
+  /**
+   * Open the given file and decode its first chunk
+   *
+   * @param filename name of the file
+   * @param sampleRate sample rate of the delivered signal
+   * @param error description of the problem, if the file cannot be used
+   * @param readAhead samples the reader keeps buffered, at sampleRate.
+   *                  Long compressed files are not decoded much further
+   *                  ahead than this.
+   * @return true if successful
+   */
+  bool open(const char* filename,int sampleRate,std::string& error,
+            int readAhead=0);
+
+  /**
+   * Deliver the next frames
+   *
+   * @return number of frames delivered.  Less than requested means the end
+   *         of the file was reached.
+   */
+  int read(float* out,int frames);
+
+  /**
+   * Name of the file
+   */
+  const std::string& name() const;
+
+  /**
+   * Sample rate of the file
+   */
+  int fileSampleRate() const;
+
+  /**
+   * Number of channels of the file
+   */
+  int channels() const;
+
+  /**
+   * Some constants
+   */
+  enum {
+    ChunkFrames=16384, /**< frames decoded at once */
+    Blocks=8,          /**< blocks of the file read ahead */
+    MapAhead=1<<20     /**< bytes of a mapping requested in advance */
+  };
+
+  /**
+   * Native sample encodings
+   */
+  enum sampleFormat {
+    Unsigned8,
+    Int16,
+    Int24,
+    Int32,
+    Float32
+  };
+
+protected:
+  /**
+   * Close the file and release the buffer
+   */
+  void close();
+
+  /**
+   * Return the blocks read ahead to the asyncIO pool and close the file
+   * descriptor
+   */
+  void releaseBlocks();
+
+  /**
+   * Deliver the next frames decoded from the file
+   */
+  int resample(float* out,int frames);
+
+  /**
+   * Start keeping the delivered signal for the cache, if the file has the
+   * given number of frames and fits the cache
+   */
+  void startRecording(long long fileFrames,long long modified);
+
+  /**
+   * Decode the next chunk into mono_.  Returns false at the end of the
+   * file.
+   */
+  bool decode();
+
+  /**
+   * Decode the next chunk from the mapping
+   */
+  bool decodeMapped();
+
+  /**
+   * Map the file if it is an uncompressed WAV file.  Returns false if the
+   * file has to be read with libsndfile.
+   */
+  bool openMapped();
+
+  /**
+   * Request the pages of the mapping ahead of framePos_
+   */
+  void adviseAhead();
+
+  /**
+   * @name Memory mapped WAV file
+   */
+  //{
+  /**
+   * Whole file mapped, or 0
+   */
+  void* map_;
+
+  /**
+   * Size of the mapping
+   */
+  long long mapSize_;
+
+  /**
+   * First frame of the samples in the mapping
+   */
+  const unsigned char* data_;
+
+  /**
+   * Number of frames in the mapping
+   */
+  long long dataFrames_;
+
+  /**
+   * Bytes per frame, and per sample
+   */
+  int blockAlign_;
+  int sampleBytes_;
+
+  /**
+   * Frame of the mapping to be decoded next
+   */
+  long long framePos_;
+
+  /**
+   * End of the pages already requested, as offset in the mapping
+   */
+  long long advised_;
+  //}
+
+  /**
+   * @name Virtual file for libsndfile
+   */
+  //{
+  static sf_count_t fileLength(void* stream);
+  static sf_count_t fileSeek(sf_count_t offset,int whence,void* stream);
+  static sf_count_t fileRead(void* ptr,sf_count_t count,void* stream);
+  static sf_count_t fileWrite(const void* ptr,sf_count_t count,void* stream);
+  static sf_count_t fileTell(void* stream);
+  //}
+
+  /**
+   * Copy count bytes at filePos_ into ptr
+   */
+  sf_count_t readBytes(char* ptr,sf_count_t count);
+
+  /**
+   * Block with the given index of the file, read if necessary
+   */
+  asyncIO::request& fetch(long long index);
+
+  /**
+   * Request the blocks following the given one
+   */
+  void prefetch(long long index);
+
+  /**
+   * Request the block with the given index into its slot
+   */
+  void request(long long index);
+
+  /**
+   * File descriptor (-1 if libsndfile opened the file)
+   */
+  int fd_;
+
+  /**
+   * Size of the file in bytes
+   */
+  long long fileSize_;
+
+  /**
+   * Position of libsndfile in the file
+   */
+  long long filePos_;
+
+  /**
+   * Blocks read ahead.  The block with index i goes to slot i%Blocks.
+   */
+  asyncIO::request blocks_[Blocks];
+
+  /**
+   * Name of the file
+   */
+  std::string name_;
+
+  /**
+   * Handler of the file
+   */
+  SNDFILE* file_;
+
+  /**
+   * Sample rate of the file
+   */
+  int fileSampleRate_;
+
+  /**
+   * Number of channels of the file
+   */
+  int channels_;
+
+  /**
+   * Encoding of the samples, as read from the mapping or from libsndfile
+   */
+  sampleFormat format_;
+
+  /**
+   * Sample rate of the delivered signal
+   */
+  int sampleRate_;
+
+  /**
+   * Samples of a chunk as delivered by libsndfile, in format_ (0 if read
+   * as float)
+   */
+  void* native_;
+
+  /**
+   * Chunk converted to float, with channels_ interleaved channels (0 if
+   * the samples are converted or downmixed straight into mono_)
+   */
+  float* buffer_;
+
+  /**
+   * Decoded chunk, downmixed to mono
+   */
+  float* mono_;
+
+  /**
+   * Decoder used instead of file_ for long compressed files, or 0
+   */
+  parallelDecoder* parallel_;
+
+  /**
+   * Number of frames in mono_
+   */
+  int frames_;
+
+  /**
+   * Frame of mono_ to be delivered next
+   */
+  int pos_;
+
+  /**
+   * Fraction of a file frame already advanced, in units of 1/sampleRate_
+   */
+  int phase_;
+
+  /**
+   * Cached signal played instead of the file (pos_ is the next sample), or
+   * empty
+   */
+  std::shared_ptr<const audioCache::entry> cached_;
+
+  /**
+   * Signal delivered so far, to be cached at the end of the file, or empty
+   */
+  std::shared_ptr<audioCache::entry> record_;
+
+  /**
+   * Number of samples the whole file delivers
+   */
+  long long expected_;
+};
+
+#endif // AUDIOSTREAM_H
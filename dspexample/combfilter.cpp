@@ -26,11 +26,18 @@
  */
 
 #include "combfilter.h"
+#include "simd.h"
 #include <cmath>
 #include <cstring>
+#include <limits>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 combFilter::combFilter()
-  : ringBuffer_(0),ringBufferSize_(0),k_(0),alpha_(0.0f),beta_(0.0f),idx_(0) {
+  : ringBuffer_(0),ringBufferSize_(0),k_(fracDelay::MinDelay),alpha_(0.0f),
+    bandwidth_(0.0f),sampleRate_(0),idx_(0) {
 }
 
 /*
@@ -53,30 +60,63 @@ void combFilter::init(int sampleRate,
                       float cutFrequency,
                       float bandwidth) {
 
-  k_ = sampleRate/cutFrequency;
+  sampleRate_ = sampleRate;
+  bandwidth_ = bandwidth;
 
-  // find the next base-2 number that can hold the required sample number
-  ringBufferSize_ = 1 << static_cast<int>(ceil(log(k_+1)/log(2.0f)));
+  const float k = float(sampleRate)/cutFrequency;
 
+  // find the next base-2 number that can hold the required sample number,
+  // leaving room to lower the base frequency an octave
+  ringBufferSize_ = 1 << static_cast<int>(ceil(log(2*k+fracDelay::Span+1)/
+                                               log(2.0f)));
 
   delete[] ringBuffer_;
   ringBuffer_ = new float[ringBufferSize_];
 
   memset(ringBuffer_,0,sizeof(float)*ringBufferSize_);/* initial conditions 0 */
 
-  float gamma = cos(bandwidth*3.14159265358979323f*k_/sampleRate);
-
-  alpha_ = (1.0f-sqrt(1.0f-gamma*gamma))/gamma;
-  beta_  = (1.0f+alpha_)/2.0f;
+  // no ramp on initialization
+  setFrequency(cutFrequency);
+  k_.jump(k_.target());
+  alpha_.jump(alpha_.target());
 
   idx_=0;
 }
 
+float combFilter::alpha(float k) const {
+  float gamma = cos(bandwidth_*3.14159265358979323f*k/sampleRate_);
+
+  return (1.0f-sqrt(1.0f-gamma*gamma))/gamma;
+}
+
+/*
+ * Change the base frequency
+ */
+void combFilter::setFrequency(float cutFrequency) {
+  float k = float(sampleRate_)/cutFrequency;
+
+  const float maxk = ringBufferSize_-fracDelay::Span;
+  if (k>maxk) {
+    k=maxk;
+  }
+  if (k<fracDelay::MinDelay) {
+    k=fracDelay::MinDelay;
+  }
+
+  // the ring buffer is not touched: the new delay is reached with a ramp
+  k_.set(k);
+  alpha_.set(alpha(k));
+}
+
+float combFilter::getFrequency() const {
+  return float(sampleRate_)/k_.target();
+}
+
 /**
  * Filter the in buffer and leave the result in out
  */
 void combFilter::filter(int blockSize,
-                        float* in,
+                        const float* in,
                         float* out) {
 
   // the diference equation in Direct Form II is
@@ -84,13 +124,92 @@ void combFilter::filter(int blockSize,
   // y(n)=v(n)-v(n-k)
 
   const int mask = ringBufferSize_-1;
-  float vnmk,vn;
 
-  for (int n=0;n<blockSize;++n) {
-    int nmk=(idx_-k_) & mask; // performing modulo with bitwise and
-    vnmk = ringBuffer_[nmk];
-    ringBuffer_[idx_]=vn=alpha_*vnmk+beta_*in[n];
+  const bool kRamp = k_.begin(blockSize);
+  const bool alphaRamp = alpha_.begin(blockSize);
+
+  if (kRamp || alphaRamp) {
+    // parameters change from sample to sample
+    for (int n=0;n<blockSize;++n) {
+      const float a = alpha_.next();
+      const float vnmk = fracDelay::read(ringBuffer_,mask,idx_,k_.next());
+      const float vn = simd::flushDenormal(a*vnmk+0.5f*(1.0f+a)*in[n]);
+      ringBuffer_[idx_]=vn;
+      out[n]=vn-vnmk;
+      idx_ = (idx_+1) & mask;
+    }
+    return;
+  }
+
+  const float a = alpha_.value();
+  const float b = 0.5f*(1.0f+a);
+  float c[fracDelay::Span];
+  const int i=fracDelay::coefficients(k_.value(),c);
+
+#ifdef __SSE__
+  const __m128 vc[fracDelay::Span] = {
+    _mm_set1_ps(c[0]),_mm_set1_ps(c[1]),_mm_set1_ps(c[2]),_mm_set1_ps(c[3])
+  };
+  const __m128 va=_mm_set1_ps(a);
+  const __m128 vb=_mm_set1_ps(b);
+#endif
+
+  int n=0;
+  while (n<blockSize) {
+#ifdef __SSE__
+    // four samples at once, if they do not depend on each other
+    if ((n+4<=blockSize) &&
+        fracDelay::vectorizable(ringBufferSize_,idx_,i)) {
+      const __m128 vnmk=fracDelay::read4(ringBuffer_,idx_,i,vc);
+      const __m128 vn=simd::flushDenormal(
+                         _mm_add_ps(_mm_mul_ps(va,vnmk),
+                                    _mm_mul_ps(vb,_mm_loadu_ps(in+n))));
+      _mm_storeu_ps(ringBuffer_+idx_,vn);
+      _mm_storeu_ps(out+n,_mm_sub_ps(vn,vnmk));
+      idx_ = (idx_+4) & mask;
+      n+=4;
+      continue;
+    }
+#endif
+    const int p=idx_-i+1; // performing modulo with bitwise and
+    const float vnmk=c[0]*ringBuffer_[p & mask]     +
+                     c[1]*ringBuffer_[(p-1) & mask] +
+                     c[2]*ringBuffer_[(p-2) & mask] +
+                     c[3]*ringBuffer_[(p-3) & mask];
+    const float vn=simd::flushDenormal(a*vnmk+b*in[n]);
+    ringBuffer_[idx_]=vn;
     out[n]=vn-vnmk;
     idx_ = (idx_+1) & mask;
+    ++n;
   }
 }
+
+/*
+ * Reset the filter state
+ */
+void combFilter::reset() {
+  memset(ringBuffer_,0,sizeof(float)*ringBufferSize_);
+  idx_=0;
+}
+
+/*
+ * Length of the impulse response until it decays below epsilon
+ */
+int combFilter::impulseResponseSize(float epsilon) const {
+  // the response has only non-zero samples around every k samples, which
+  // decay as alpha^m
+  const double a = alpha_.target();
+  const double m = (a>0.0) ? ceil(log(double(epsilon))/log(a)) : 1.0;
+  const double size = m*ceil(double(k_.target()))+fracDelay::Span;
+  if (!(size < double(std::numeric_limits<int>::max()))) {
+    return std::numeric_limits<int>::max(); // it practically never decays
+  }
+  return static_cast<int>(size);
+}
+
+/*
+ * Number of samples the output needs to decay below epsilon
+ */
+int combFilter::tailLength(float epsilon) const {
+  return impulseResponseSize(epsilon)-1;
+}
@@ -28,6 +28,8 @@
 #ifndef COMBFILTER_H
 #define COMBFILTER_H
 
+#include "fracdelay.h"
+
 /**
  * Comb filter class
  *
@@ -37,6 +39,10 @@
  * \f[
  * y(n)=\beta(x(n)-x(n-k)) + \alpha y(n-k)
  * \f]
+ *
+ * The delay k=f_s/f_c is fractional, so that any base frequency can be
+ * removed, not only those dividing the sample rate.  Changes of the base
+ * frequency are ramped over the next processed block.
  */
 class combFilter {
 public:
@@ -66,9 +72,39 @@ public:
    * Filter the in buffer and leave the result in out
    */
   void filter(int blockSize,
-              float* in,
+              const float* in,
               float* out);
 
+  /**
+   * Change the base frequency, keeping the bandwidth.
+   *
+   * The delay cannot grow beyond the one of half the frequency given at
+   * init().
+   */
+  void setFrequency(float cutFrequency);
+
+  /**
+   * Base frequency in use
+   */
+  float getFrequency() const;
+
+  /**
+   * Reset the filter state
+   */
+  void reset();
+
+  /**
+   * Length of the impulse response, in samples, until its envelope decays
+   * below the given fraction of the first sample
+   */
+  int impulseResponseSize(float epsilon) const;
+
+  /**
+   * Number of samples the output needs to decay below epsilon times the
+   * level of the last input, after the input becomes silent
+   */
+  int tailLength(float epsilon) const;
+
 protected:
   /**
    * Ring buffer
@@ -83,19 +119,29 @@ protected:
   int ringBufferSize_;
 
   /**
-   * Delay
+   * Delay, in samples
+   */
+  rampedValue k_;
+
+  /**
+   * Alpha coefficient.  The beta coefficient is (1+alpha)/2.
+   */
+  rampedValue alpha_;
+
+  /**
+   * Bandwidth in Hz
    */
-  int k_;
+  float bandwidth_;
 
   /**
-   * Alpha coefficient
+   * Sample rate
    */
-  float alpha_;
+  int sampleRate_;
 
   /**
-   * Beta coefficient
+   * Alpha coefficient for the given delay in samples
    */
-  float beta_;
+  float alpha(float k) const;
 
   /**
    * Index of the last processed data in the ring buffer
@@ -8,6 +8,25 @@ TEMPLATE = app
 LIBS += -lfftw3f \
     -ljack \
     -lsndfile
+QMAKE_CXXFLAGS += -std=c++14
+# The default build runs on any x86-64 processor.  The AVX2 and F16C
+# kernels are enabled with "qmake CONFIG+=avx2", or with everything the
+# build host supports with "qmake CONFIG+=native" (such a binary may not
+# run on other processors).
+avx2 {
+    QMAKE_CXXFLAGS += -msse4.1 \
+        -mavx2 \
+        -mf16c
+}
+native {
+    QMAKE_CXXFLAGS += -march=native
+}
+# asynchronous file I/O through io_uring, if available
+CONFIG += link_pkgconfig
+packagesExist(liburing) {
+    DEFINES += HAVE_LIBURING
+    PKGCONFIG += liburing
+}
 SOURCES += fileManager.cpp \
     fir.cpp \
     main.cpp \
@@ -17,7 +36,18 @@ SOURCES += fileManager.cpp \
     jack.cpp \
     dspsystem.cpp \
     combfilter.cpp \
-    reverb.cpp
+    reverb.cpp \
+    simd.cpp \
+    silencegate.cpp \
+    schroederreverb.cpp \
+    fdnreverb.cpp \
+    multitap.cpp \
+    humcanceller.cpp \
+    audiostream.cpp \
+    audiocache.cpp \
+    paralleldecoder.cpp \
+    mixer.cpp \
+    asyncio.cpp
 HEADERS += fileManager.h \
     fir.h \
     mainwindow.h \
@@ -27,5 +57,21 @@ HEADERS += fileManager.h \
     processor.h \
     dspsystem.h \
     combfilter.h \
-    reverb.h
+    reverb.h \
+    smallfft.h \
+    fracdelay.h \
+    spscqueue.h \
+    reclaimer.h \
+    samplering.h \
+    simd.h \
+    silencegate.h \
+    schroederreverb.h \
+    fdnreverb.h \
+    multitap.h \
+    humcanceller.h \
+    audiostream.h \
+    audiocache.h \
+    paralleldecoder.h \
+    mixer.h \
+    asyncio.h
 FORMS += mainwindow.ui
@@ -26,7 +26,14 @@
  */
 
 #include "dspsystem.h"
+#include "simd.h"
+#include <cstdlib>
 #include <cstring>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
 
 #undef _DSP_DEBUG
 #define _DSP_DEBUG
@@ -38,11 +45,26 @@
 #define _debug(x)
 #endif
 
+/*
+ * Stages are skipped once their tails decayed 80dB
+ */
+const float dspSystem::TailEpsilon = 0.0001f;
 
 dspSystem::dspSystem()
-  : eq_(0),fFilt_(0),fm_(0),ff_(0),cf_(0),rv_(0),
-    eqhnSize_(0),eqHwSize_(0),sampleRate_(0),bufferSize_(0),
-    equalizerOn_(false),filter60On_(false),reverbOn_(false),firOn_(false),wfOn_(true){
+  : eq_(0),fFilt_(0),fm_(0),ff_(0),cf_(0),hc_(0),
+    filter60Type_(CombFilter60),rv_(0),sr_(0),fd_(0),mt_(0),
+    reverbType_(SimpleReverb),
+    eqhnSize_(0),eqHwSize_(0),
+    sampleRate_(0),bufferSize_(0),maxBlockSize_(0),scratch_(0),
+    equalizerOn_(false),filter60On_(false),reverbOn_(false),multiTapOn_(false),firOn_(false),wfOn_(true),
+    halfPrecision_(false),
+    pendingCount_(0),frameTime_(0),frameTimeSnapshot_(0),
+    requestedReverbType_(SimpleReverb),requestedFilter60Type_(CombFilter60){
+  for (int i=0;i<=FDNReverb;++i)
+  {
+    alphaSnapshot_[i].store(0.0f);
+    delaySnapshot_[i].store(0.0f);
+  }
 }
 
 dspSystem::~dspSystem()
@@ -56,14 +78,371 @@ dspSystem::~dspSystem()
   delete cf_;
   cf_=0;
 
+  delete hc_;
+  hc_=0;
+
   delete rv_;
   rv_=0;
 
+  delete sr_;
+  sr_=0;
+
+  delete fd_;
+  fd_=0;
+
+  delete mt_;
+  mt_=0;
+
   delete fFilt_;
   fFilt_=0;
 
   delete fm_;
   fm_=0;
+
+  delete[] scratch_;
+  scratch_=0;
+}
+
+/*
+ * Queue a command for the processing thread
+ */
+bool dspSystem::post(commandId id,int value,float param,float param2)
+{
+  const command cmd = { id, value, param, param2, Immediately };
+  return push(cmd);
+}
+
+/*
+ * Queue a command that takes effect at the given frame
+ */
+bool dspSystem::schedule(commandId id,int value,float param,int64_t frame)
+{
+  const command cmd = { id, value, param, 0.0f, frame };
+  return push(cmd);
+}
+
+/*
+ * Schedule the parameter changes of an automation file
+ */
+int dspSystem::loadAutomation(const char* filename)
+{
+  std::ifstream file(filename);
+  if (!file)
+  {
+    return -1;
+  }
+
+  // the times are relative to the block being processed now
+  const int64_t start=frameTime();
+
+  int count=0;
+  int lineNumber=0;
+  std::string line;
+  while (std::getline(file,line) && (count<MaxPending))
+  {
+    ++lineNumber;
+    std::istringstream fields(line);
+    double seconds;
+    std::string name,value;
+    if (!(fields >> seconds))
+    {
+      if (!line.empty() && (line[0]!='#'))
+      {
+        std::cerr << filename << ":" << lineNumber
+                  << ": time expected" << std::endl;
+      }
+      continue;
+    }
+    fields >> name >> value;
+
+    const bool on=(value=="on");
+    const float param=static_cast<float>(atof(value.c_str()));
+
+    commandId id;
+    if (name=="equalizer")
+    {
+      id=SetEqualizer;
+    }
+    else if (name=="filter60")
+    {
+      id=SetFilter60;
+    }
+    else if (name=="reverb")
+    {
+      id=SetReverb;
+    }
+    else if (name=="multitap")
+    {
+      id=SetMultiTap;
+    }
+    else if (name=="reverb-alpha")
+    {
+      id=SetReverbAlpha;
+    }
+    else if (name=="reverb-delay")
+    {
+      id=SetReverbDelay;
+    }
+    else if (name=="reverb-damping")
+    {
+      id=SetReverbDamping;
+    }
+    else if (name=="reverb-mix")
+    {
+      id=SetReverbMix;
+    }
+    else if (name=="reverb-reset")
+    {
+      id=ResetReverb;
+    }
+    else if (name=="hum-step")
+    {
+      id=SetHumStepSize;
+    }
+    else
+    {
+      std::cerr << filename << ":" << lineNumber
+                << ": unknown parameter " << name << std::endl;
+      continue;
+    }
+
+    const int64_t frame=start+static_cast<int64_t>(seconds*sampleRate_+0.5);
+    if (!schedule(id,on,param,frame))
+    {
+      break;
+    }
+    ++count;
+  }
+
+  return count;
+}
+
+/*
+ * Push a command into the queue
+ */
+bool dspSystem::push(const command& cmd)
+{
+  // the queue only fills up if the processing thread stopped draining it,
+  // or if many commands are posted at once
+  if (!commands_.push(cmd))
+  {
+    _debug("dspSystem: command queue full, command dropped" << std::endl);
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Apply all queued commands that are already due
+ */
+void dspSystem::applyCommands()
+{
+  collectCommands();
+  applyDueCommands(frameTime_,frameTime_);
+}
+
+/*
+ * Move the queued commands to the pending list, sorted by frame.  Called
+ * by the processing thread at the beginning of each block.
+ */
+void dspSystem::collectCommands()
+{
+  command cmd;
+  while (commands_.pop(cmd))
+  {
+    if (pendingCount_==MaxPending)
+    {
+      // no room to keep it for later: better early than never
+      if (apply(cmd))
+      {
+        updateSnapshots();
+      }
+      continue;
+    }
+
+    // insertion after all commands due at the same frame or before, which
+    // keeps the order in which they were posted
+    int i=pendingCount_++;
+    while ((i>0) && (pending_[i-1].frame>cmd.frame))
+    {
+      pending_[i]=pending_[i-1];
+      --i;
+    }
+    pending_[i]=cmd;
+  }
+}
+
+/*
+ * Apply the pending commands due at the frame now or before, and return
+ * the frame of the next pending command, limited to end
+ */
+int64_t dspSystem::applyDueCommands(int64_t now,int64_t end)
+{
+  int due=0;
+  bool reverbChanged=false;
+  while ((due<pendingCount_) && (pending_[due].frame<=now))
+  {
+#ifdef _DSP_DEBUG
+    // a command collected before its frame has to land exactly on it
+    if ((pending_[due].frame>=frameTime_) && (pending_[due].frame!=now))
+    {
+      _debug("dspSystem: command for frame " << pending_[due].frame
+             << " applied at frame " << now << std::endl);
+    }
+#endif
+    reverbChanged = apply(pending_[due]) || reverbChanged;
+    ++due;
+  }
+
+  if (due>0)
+  {
+    pendingCount_-=due;
+    memmove(pending_,pending_+due,pendingCount_*sizeof(command));
+  }
+
+  if (reverbChanged)
+  {
+    updateSnapshots();
+  }
+
+  if ((pendingCount_>0) && (pending_[0].frame<end))
+  {
+    return pending_[0].frame;
+  }
+  return end;
+}
+
+/*
+ * Apply one command.  Returns true if the reverberation parameters changed.
+ */
+bool dspSystem::apply(const command& cmd)
+{
+  bool reverbChanged=false;
+
+  switch(cmd.id)
+  {
+  case SetEqualizer:
+    if (!cmd.value)
+    {
+      ff_->reset();
+    }
+    equalizerOn_=(cmd.value!=0);
+    break;
+  case SetFilter60:
+    filter60On_=(cmd.value!=0);
+    break;
+  case SetFilter60Type:
+    if (cmd.value!=filter60Type_)
+    {
+      filter60Type_=static_cast<filter60Type>(cmd.value);
+      cf_->reset();
+      hc_->reset();
+      cfGate_.reset();
+      hcGate_.reset();
+    }
+    break;
+  case SetReverb:
+    reverbOn_=(cmd.value!=0);
+    break;
+  case SetMultiTap:
+    multiTapOn_=(cmd.value!=0);
+    break;
+  case SetFFilter:
+    firOn_=(cmd.value!=0);
+    break;
+  case SetFileManager:
+    wfOn_=(cmd.value!=0);
+    break;
+  case SetReverbType:
+    if (cmd.value!=reverbType_)
+    {
+      reverbType_=static_cast<reverbType>(cmd.value);
+      rvGate_.reset();
+      resetReverbState();
+    }
+    break;
+  case SetReverbAlpha:
+    switch(reverbType_)
+    {
+    case SchroederReverb:
+      sr_->setAlpha(cmd.param);
+      break;
+    case FDNReverb:
+      fd_->setAlpha(cmd.param);
+      break;
+    default:
+      rv_->setAlpha(cmd.param);
+    }
+    reverbChanged=true;
+    break;
+  case SetReverbDelay:
+    switch(reverbType_)
+    {
+    case SchroederReverb:
+      sr_->setDelay(cmd.param);
+      break;
+    case FDNReverb:
+      fd_->setDelay(cmd.param);
+      break;
+    default:
+      rv_->setDelay(cmd.param);
+    }
+    reverbChanged=true;
+    break;
+  case SetReverbDamping:
+    switch(reverbType_)
+    {
+    case SchroederReverb:
+      sr_->setDamping(cmd.param);
+      break;
+    case FDNReverb:
+      fd_->setDamping(cmd.param);
+      break;
+    default:
+      break;
+    }
+    break;
+  case SetReverbMix:
+    switch(reverbType_)
+    {
+    case SchroederReverb:
+      sr_->setMix(cmd.param);
+      break;
+    case FDNReverb:
+      fd_->setMix(cmd.param);
+      break;
+    default:
+      break;
+    }
+    break;
+  case ResetReverb:
+    resetReverbState();
+    break;
+  case SetHumStepSize:
+    hc_->setStepSize(cmd.param);
+    break;
+  case ClearTaps:
+    mt_->clearTaps();
+    break;
+  case AddTap:
+    mt_->addTap(cmd.param,cmd.param2);
+    break;
+  }
+
+  return reverbChanged;
+}
+
+/*
+ * Publish the reverberation parameters for the GUI thread
+ */
+void dspSystem::updateSnapshots()
+{
+  alphaSnapshot_[SimpleReverb].store(rv_->getAlpha());
+  delaySnapshot_[SimpleReverb].store(rv_->getDelay());
+  alphaSnapshot_[SchroederReverb].store(sr_->getAlpha());
+  delaySnapshot_[SchroederReverb].store(sr_->getDelay());
+  alphaSnapshot_[FDNReverb].store(fd_->getAlpha());
+  delaySnapshot_[FDNReverb].store(fd_->getDelay());
 }
 
 /*
@@ -71,10 +450,7 @@ dspSystem::~dspSystem()
  */
 void dspSystem::setEqualizer(bool on)
 {
-  if (!on) {
-    ff_->reset();
-  }
-  equalizerOn_=on;
+  post(SetEqualizer,on);
 }
 
 /*
@@ -82,7 +458,26 @@ void dspSystem::setEqualizer(bool on)
  */
 void dspSystem::setFilter60(bool on)
 {
-  filter60On_=on;
+  post(SetFilter60,on);
+}
+
+/*
+ * Select the 60Hz filter
+ */
+void dspSystem::setFilter60Type(filter60Type type)
+{
+  requestedFilter60Type_.store(type);
+  post(SetFilter60Type,type);
+}
+
+dspSystem::filter60Type dspSystem::getFilter60Type() const
+{
+  return static_cast<filter60Type>(requestedFilter60Type_.load());
+}
+
+void dspSystem::setHumStepSize(float stepSize)
+{
+  post(SetHumStepSize,0,stepSize);
 }
 
 /*
@@ -90,22 +485,222 @@ void dspSystem::setFilter60(bool on)
  */
 void dspSystem::setReverb(bool on)
 {
-  reverbOn_=on;
+  post(SetReverb,on);
+}
+
+/*
+ * Half precision storage, used from the next init() on
+ */
+void dspSystem::setHalfPrecision(bool on)
+{
+  halfPrecision_=on;
+}
+
+/*
+ * (De)activate multi-tap delay
+ */
+void dspSystem::setMultiTap(bool on)
+{
+  post(SetMultiTap,on);
+}
+
+/*
+ * Edit the tap table of the multi-tap delay
+ */
+void dspSystem::clearTaps()
+{
+  post(ClearTaps);
+}
+
+bool dspSystem::addTap(float delay,float gain)
+{
+  return post(AddTap,0,delay,gain);
+}
+
+int dspSystem::setTaps(int taps,const float* delays,const float* gains)
+{
+  if (!post(ClearTaps))
+  {
+    return 0;
+  }
+
+  int i=0;
+  while ((i<taps) && addTap(delays[i],gains[i]))
+  {
+    ++i;
+  }
+  return i;
 }
 
 void dspSystem::setFFilter(bool on)
 {
-  firOn_=on;
+  post(SetFFilter,on);
 }
 
 void dspSystem::setFileManager(bool on)
 {
-  wfOn_=on;
+  post(SetFileManager,on);
+}
+
+/*
+ * Select the reverberation engine
+ */
+void dspSystem::setReverbType(reverbType type)
+{
+  requestedReverbType_.store(type);
+  post(SetReverbType,type);
+}
+
+dspSystem::reverbType dspSystem::getReverbType() const
+{
+  return static_cast<reverbType>(requestedReverbType_.load());
+}
+
+void dspSystem::setReverbAlpha(float alpha)
+{
+  post(SetReverbAlpha,0,alpha);
+}
+
+float dspSystem::getReverbAlpha() const
+{
+  return alphaSnapshot_[requestedReverbType_.load()].load();
+}
+
+void dspSystem::setReverbDelay(float delay)
+{
+  post(SetReverbDelay,0,delay);
+}
+
+float dspSystem::getReverbDelay() const
+{
+  return delaySnapshot_[requestedReverbType_.load()].load();
+}
+
+void dspSystem::setReverbDamping(float damping)
+{
+  post(SetReverbDamping,0,damping);
+}
+
+void dspSystem::setReverbMix(float wet)
+{
+  post(SetReverbMix,0,wet);
+}
+
+void dspSystem::resetReverb()
+{
+  post(ResetReverb);
 }
 
-reverb* dspSystem::getReverberator()
+int64_t dspSystem::frameTime() const
+{
+  return frameTimeSnapshot_.load();
+}
+
+/*
+ * Reset the reverberation engine in use (processing thread only)
+ */
+void dspSystem::resetReverbState()
 {
-  return rv_;
+  switch(reverbType_)
+  {
+  case SchroederReverb:
+    sr_->reset();
+    break;
+  case FDNReverb:
+    fd_->reset();
+    break;
+  default:
+    rv_->reset();
+  }
+}
+
+/*
+ * Take the oldest pending sanitizer event
+ */
+bool dspSystem::popEvent(sanitizerEvent& event)
+{
+  return events_.pop(event);
+}
+
+const char* dspSystem::stageName(stageId stage)
+{
+  switch(stage)
+  {
+  case InputStage:
+    return "input";
+  case MultiTapStage:
+    return "multi-tap delay";
+  case ReverbStage:
+    return "reverberator";
+  case EqualizerStage:
+    return "equalizer";
+  case Filter60Stage:
+    return "60Hz filter";
+  }
+  return "unknown";
+}
+
+/*
+ * Reset the state of the given stage
+ */
+void dspSystem::resetStage(stageId stage)
+{
+  switch(stage)
+  {
+  case MultiTapStage:
+    mt_->reset();
+    break;
+  case ReverbStage:
+    resetReverbState();
+    break;
+  case EqualizerStage:
+    ff_->reset();
+    break;
+  case Filter60Stage:
+    if (filter60Type_==AdaptiveFilter60)
+    {
+      hc_->reset();
+    }
+    else
+    {
+      cf_->reset();
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+/*
+ * Check the output of a stage
+ */
+void dspSystem::sanitize(stageId stage,float* buffer,int n)
+{
+  const int bad=simd::sanitize(buffer,n);
+  if (bad>0)
+  {
+    resetStage(stage);
+
+    // if the queue is full the event is lost, but the stage is reset anyway
+    sanitizerEvent event = { stage, bad };
+    events_.push(event);
+  }
+}
+
+/*
+ * Samples the reverberation engine in use needs to decay below TailEpsilon
+ */
+int dspSystem::reverbTailLength() const
+{
+  switch(reverbType_)
+  {
+  case SchroederReverb:
+    return sr_->tailLength(TailEpsilon);
+  case FDNReverb:
+    return fd_->tailLength(TailEpsilon);
+  default:
+    return rv_->tailLength(TailEpsilon);
+  }
 }
 
 
@@ -119,6 +714,10 @@ bool dspSystem::init(const int sampleRate,const int bufferSize)
   sampleRate_ = sampleRate;
   bufferSize_ = bufferSize;
 
+  maxBlockSize_ = bufferSize;
+  delete[] scratch_;
+  scratch_ = new float[maxBlockSize_];
+
   eqHwSize_=bufferSize*2;
   eqhnSize_=bufferSize*3/4;
 
@@ -126,7 +725,7 @@ bool dspSystem::init(const int sampleRate,const int bufferSize)
   eq_=new equalizer(16,eqhnSize_,eqHwSize_);
 
   delete ff_;
-  ff_=new freqFilter(bufferSize);
+  ff_=new freqFilter(bufferSize,halfPrecision_);
 
   delete cf_;
   cf_=new combFilter();
@@ -134,12 +733,39 @@ bool dspSystem::init(const int sampleRate,const int bufferSize)
   // comb filter should remove 6Hz centered on 60Hz x k
   cf_->init(sampleRate,60.0f,6.0f);
 
+  delete hc_;
+  hc_=new humCanceller();
+
+  // the first 8 harmonics carry almost all of the hum energy
+  hc_->init(sampleRate,60.0f,8,0.05f);
+
   delete rv_;
-  rv_=new reverb();
+  rv_=new reverb(halfPrecision_);
 
   // use some dummy values first.
   rv_->init(sampleRate,1000,0.5f);
 
+  delete sr_;
+  sr_=new schroederReverb();
+
+  // a medium sized room
+  sr_->init(sampleRate,40.0f,0.84f);
+
+  delete fd_;
+  fd_=new fdnReverb(8);
+
+  // same room, with the longest line a bit longer than the combs
+  fd_->init(sampleRate,60.0f,0.84f);
+
+  delete mt_;
+  mt_=new multiTap();
+  mt_->init(sampleRate,bufferSize);
+
+  // direct sound followed by a few early reflections of a small room
+  static const float erDelays[] = { 0.0f, 7.3f,11.9f,17.1f,23.7f,31.3f};
+  static const float erGains[]  = { 1.0f,0.62f,0.51f,0.42f,0.33f,0.26f};
+  mt_->setTaps(6,erDelays,erGains);
+
   delete fFilt_;
   fFilt_=new fir();
   fFilt_->initFir();
@@ -148,6 +774,11 @@ bool dspSystem::init(const int sampleRate,const int bufferSize)
   fm_=new fileManager();
   fm_->initFile("Valores_En_Filtro.txt");
 
+  // the processing thread is not running yet: commands posted so far can
+  // be applied here
+  applyCommands();
+  updateSnapshots();
+
   updateEqualizer();
 
   return true;
@@ -176,28 +807,104 @@ void dspSystem::updateEqualizer()
   // no assign that frequency response to the frequency domain filter
   ff_->setFilter(eq_->getFrequencyResponse(),eqHwSize_,eqhnSize_);
 #endif
-
 }
 
 /**
  * Processing function inside dspsystem.cpp
  */
-bool dspSystem::process(float* in,float* out)
+bool dspSystem::process(const float* in,float* out,const int nframes)
+{
+  collectCommands();
+
+  const int64_t start=frameTime_;
+  int pos=0;
+  while (pos<nframes)
+  {
+    // everything due up to this frame, then up to the next event, in
+    // spans that fit in the scratch buffer
+    int next=applyDueCommands(start+pos,start+nframes)-start;
+    if (next-pos>maxBlockSize_)
+    {
+      next=pos+maxBlockSize_;
+    }
+    processSpan(in+pos,out+pos,next-pos);
+    pos=next;
+  }
+
+  frameTime_+=nframes;
+  frameTimeSnapshot_.store(frameTime_);
+  return true;
+}
+
+/*
+ * Process a span of n frames with constant parameters
+ */
+void dspSystem::processSpan(const float* in,float* out,int n)
 {
 	//fm_->writeFile(bufferSize_,tmpIn,tmpOut);
-  if (!equalizerOn_ && !filter60On_ && !reverbOn_ && !firOn_)
+  if (!equalizerOn_ && !filter60On_ && !reverbOn_ && !multiTapOn_ && !firOn_)
   {
     // nothing to be done: just pass through
-    memcpy(out,in,bufferSize_*sizeof(float));
+    if (out!=in)
+    {
+      memcpy(out,in,n*sizeof(float));
+    }
   }
   else
   {
-    float* tmpIn = in;
+    // the input is not ours: the stages alternate between the scratch
+    // buffer and the output
+    memcpy(scratch_,in,n*sizeof(float));
+
+    // corrupted input (e.g. a bad file block) must not reach any state
+    sanitize(InputStage,scratch_,n);
+
+    float* tmpIn = scratch_;
     float* tmpOut = out;
 
+    if (multiTapOn_)
+    {
+      if (mtGate_.idle(tmpIn,n,mt_->tailLength()))
+      {
+        if (mtGate_.entered())
+        {
+          mt_->reset();
+        }
+        memset(tmpOut,0,n*sizeof(float));
+      }
+      else
+      {
+        mt_->filter(n,tmpIn,tmpOut);
+        sanitize(MultiTapStage,tmpOut,n);
+      }
+      float* tmp = tmpIn;
+      tmpIn = tmpOut;
+      tmpOut = tmp;
+    }
+
     if (reverbOn_)
     {
-      rv_->filter(bufferSize_,tmpIn,tmpOut);
+      if (rvGate_.idle(tmpIn,n,reverbTailLength()))
+      {
+        if (rvGate_.entered())
+        {
+          resetReverbState();
+        }
+        memset(tmpOut,0,n*sizeof(float));
+      }
+      else if (reverbType_==SchroederReverb)
+      {
+        sr_->filter(n,tmpIn,tmpOut);
+      }
+      else if (reverbType_==FDNReverb)
+      {
+        fd_->filter(n,tmpIn,tmpOut);
+      }
+      else
+      {
+        rv_->filter(n,tmpIn,tmpOut);
+      }
+      sanitize(ReverbStage,tmpOut,n);
       float* tmp = tmpIn;
       tmpIn = tmpOut;
       tmpOut = tmp;
@@ -205,12 +912,12 @@ bool dspSystem::process(float* in,float* out)
 
     if (wfOn_)
     {
-      fm_->writeFile(bufferSize_,tmpIn,tmpOut);
+      fm_->writeFile(n,tmpIn,tmpOut);
     }
 
     /*if (firOn_)
     {
-      f_->filterFir(bufferSize_,tmpIn,tmpOut);
+      f_->filterFir(n,tmpIn,tmpOut);
       float* tmp = tmpIn;
       tmpIn = tmpOut;
       tmpOut = tmp;
@@ -218,15 +925,55 @@ bool dspSystem::process(float* in,float* out)
 
     if (equalizerOn_)
     {
-      ff_->filter(tmpIn,tmpOut);
+      if (ffGate_.idle(tmpIn,n,ff_->tailLength()))
+      {
+        if (ffGate_.entered())
+        {
+          ff_->reset();
+        }
+        memset(tmpOut,0,n*sizeof(float));
+      }
+      else
+      {
+        ff_->filter(tmpIn,tmpOut,n);
+        sanitize(EqualizerStage,tmpOut,n);
+      }
       float* tmp = tmpIn;
       tmpIn = tmpOut;
       tmpOut = tmp;
     }
 
-    if (filter60On_)
+    if (filter60On_ && (filter60Type_==AdaptiveFilter60))
+    {
+      // silent blocks are passed as they are, keeping the lock
+      if (hcGate_.idle(tmpIn,n,hc_->tailLength()))
+      {
+        memset(tmpOut,0,n*sizeof(float));
+      }
+      else
+      {
+        hc_->filter(n,tmpIn,tmpOut);
+        sanitize(Filter60Stage,tmpOut,n);
+      }
+      float* tmp = tmpIn;
+      tmpIn = tmpOut;
+      tmpOut = tmp;
+    }
+    else if (filter60On_)
     {
-      cf_->filter(bufferSize_,tmpIn,tmpOut);
+      if (cfGate_.idle(tmpIn,n,cf_->tailLength(TailEpsilon)))
+      {
+        if (cfGate_.entered())
+        {
+          cf_->reset();
+        }
+        memset(tmpOut,0,n*sizeof(float));
+      }
+      else
+      {
+        cf_->filter(n,tmpIn,tmpOut);
+        sanitize(Filter60Stage,tmpOut,n);
+      }
       float* tmp = tmpIn;
       tmpIn = tmpOut;
       tmpOut = tmp;
@@ -234,12 +981,10 @@ bool dspSystem::process(float* in,float* out)
 
     if (tmpOut == out)
     {
-      memcpy(out,in,bufferSize_*sizeof(float));
+      memcpy(out,scratch_,n*sizeof(float));
     }
 
   }
-
-  return true;
 }
 
 /**
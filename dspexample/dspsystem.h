@@ -33,11 +33,82 @@
 #include "freqFilter.h"
 #include "combfilter.h"
 #include "reverb.h"
+#include "schroederreverb.h"
+#include "fdnreverb.h"
+#include "multitap.h"
+#include "humcanceller.h"
 #include "fir.h"
 #include "fileManager.h"
+#include "silencegate.h"
+#include "spscqueue.h"
+#include <atomic>
+#include <cstdint>
 
+/**
+ * Processing chain
+ *
+ * All setters are meant to be called from the GUI thread.  They do not
+ * touch the processing state: each change is queued as a command in a
+ * lock-free queue, which the processing thread drains at the beginning of
+ * each block, so that changes are wait-free for both threads and applied
+ * consistently at block boundaries.  The getters of the reverberation
+ * parameters read atomic snapshots published by the processing thread.
+ *
+ * New filter responses (updateEqualizer()) are computed in the calling
+ * thread and handed to the frequency filters, which swap them in at their
+ * next block.
+ */
 class dspSystem : public processor {
 public:
+  /**
+   * Available reverberation engines
+   */
+  enum reverbType {
+    SimpleReverb,   /**< Single feedback delay (reverb class) */
+    SchroederReverb, /**< Parallel combs and series allpasses */
+    FDNReverb        /**< Feedback delay network with Hadamard mixing */
+  };
+
+  /**
+   * Stages of the processing chain, after which the signal is checked
+   */
+  enum stageId {
+    InputStage,     /**< Input of the chain */
+    MultiTapStage,  /**< Multi-tap delay */
+    ReverbStage,    /**< Reverberation engine in use */
+    EqualizerStage, /**< Equalizer */
+    Filter60Stage   /**< 60Hz filter in use */
+  };
+
+  /**
+   * Report of non-finite samples found after a stage, whose state was then
+   * reset
+   */
+  struct sanitizerEvent {
+    stageId stage;
+    int samples;
+  };
+
+  /**
+   * Take the oldest pending sanitizer event.
+   *
+   * To be polled from the GUI thread.  Returns false if there is none.
+   */
+  bool popEvent(sanitizerEvent& event);
+
+  /**
+   * Name of a stage, for reports
+   */
+  static const char* stageName(stageId stage);
+
+  /**
+   * Available 60Hz filters
+   */
+  enum filter60Type {
+    CombFilter60,    /**< Fixed notches at all multiples (combFilter class) */
+    AdaptiveFilter60 /**< Tracking canceller of the first harmonics */
+  };
+
   /**
    * Constructor
    */
@@ -54,9 +125,11 @@ public:
   virtual bool init(const int frameRate,const int bufferSize);
 
   /**
-   * Processing function inside dspsystem.h
+   * Process nframes samples.  The block is split at the frames where
+   * scheduled commands take effect, and each span between them is
+   * processed by all stages with constant parameters.
    */
-  virtual bool process(float* in,float* out);
+  virtual bool process(const float* in,float* out,const int nframes);
 
   /**
    * Shutdown the processor
@@ -94,19 +167,167 @@ public:
    */
   void setFilter60(bool on=true);
 
+  /**
+   * Select the filter used to remove the 60Hz hum
+   */
+  void setFilter60Type(filter60Type type);
+
+  /**
+   * Get the filter used to remove the 60Hz hum
+   */
+  filter60Type getFilter60Type() const;
+
+  /**
+   * Set the adaptation step size of the adaptive hum canceller
+   */
+  void setHumStepSize(float stepSize);
+
   /**
    * (De)activate reverberator
    */
   void setReverb(bool on=true);
 
+  /**
+   * Store the long delay lines and the filter spectra in half precision.
+   *
+   * This only takes effect at the next call to init().
+   */
+  void setHalfPrecision(bool on=true);
+
+  /**
+   * (De)activate the multi-tap delay (early reflections)
+   */
+  void setMultiTap(bool on=true);
+
+  /**
+   * Remove all taps of the multi-tap delay
+   */
+  void clearTaps();
+
+  /**
+   * Add one tap to the multi-tap delay.  It is ignored if the tap table
+   * is already full.
+   *
+   * @param delay delay of the tap in ms
+   * @param gain gain of the tap
+   * @return false if the command queue is full and the tap was dropped
+   */
+  bool addTap(float delay,float gain);
+
+  /**
+   * Replace the tap table of the multi-tap delay.  One command per tap is
+   * queued, so a long table may not fit in the command queue at once.
+   *
+   * @return number of taps queued
+   */
+  int setTaps(int taps,const float* delays,const float* gains);
+
   void setFFilter(bool on=true);
 
   void setFileManager(bool on=true);
 
   /**
-   * Get reverberator object
+   * Select the reverberation engine used when the reverb is active
    */
-  reverb* getReverberator();
+  void setReverbType(reverbType type);
+
+  /**
+   * Get the reverberation engine in use
+   */
+  reverbType getReverbType() const;
+
+  /**
+   * Set the alpha value of the reverberation engine in use
+   */
+  void setReverbAlpha(float alpha);
+
+  /**
+   * Get the alpha value of the reverberation engine in use
+   */
+  float getReverbAlpha() const;
+
+  /**
+   * Set the delay (in ms) of the reverberation engine in use
+   */
+  void setReverbDelay(float delay);
+
+  /**
+   * Get the delay (in ms) of the reverberation engine in use
+   */
+  float getReverbDelay() const;
+
+  /**
+   * Set the damping of the reverberation engine in use.  The simple
+   * reverb has no damping and ignores it.
+   */
+  void setReverbDamping(float damping);
+
+  /**
+   * Set the wet/dry mix of the reverberation engine in use.  The simple
+   * reverb has no mix and ignores it.
+   */
+  void setReverbMix(float wet);
+
+  /**
+   * Reset the reverberation engine in use
+   */
+  void resetReverb();
+
+  /**
+   * Commands queued from the GUI thread to the processing thread
+   */
+  enum commandId {
+    SetEqualizer,
+    SetFilter60,
+    SetFilter60Type,
+    SetReverb,
+    SetMultiTap,
+    SetFFilter,
+    SetFileManager,
+    SetReverbType,
+    SetReverbAlpha,
+    SetReverbDelay,
+    SetReverbDamping,
+    SetReverbMix,
+    ResetReverb,
+    SetHumStepSize,
+    ClearTaps,
+    AddTap
+  };
+
+  /**
+   * Queue a command that takes effect exactly at the given frame, counted
+   * from the first frame processed (see frameTime()).  Commands for frames
+   * already processed take effect at the beginning of the next block.
+   *
+   * Returns false if the command queue is full and the command was
+   * dropped.
+   */
+  bool schedule(commandId id,int value,float param,int64_t frame);
+
+  /**
+   * Schedule the parameter changes listed in a text file, relative to the
+   * frame being processed now.  Each line holds the time in seconds, the
+   * parameter and its value, e.g.
+   *
+   *   1.5 reverb on
+   *   2.0 reverb-alpha 0.8
+   *
+   * The parameters are equalizer, filter60, reverb and multitap (on or
+   * off), reverb-alpha, reverb-delay (in ms), reverb-damping, reverb-mix
+   * and hum-step (numbers), and reverb-reset (no value).  Empty lines and
+   * lines starting with # are ignored.  At most MaxPending changes are
+   * taken.
+   *
+   * Returns the number of changes scheduled, or -1 if the file cannot be
+   * read.
+   */
+  int loadAutomation(const char* filename);
+
+  /**
+   * Number of frames processed so far
+   */
+  int64_t frameTime() const;
 
 protected:
   /**
@@ -125,11 +346,41 @@ protected:
    */
   combFilter* cf_;
 
+  /**
+   * Adaptive hum canceller
+   */
+  humCanceller* hc_;
+
+  /**
+   * 60Hz filter in use
+   */
+  filter60Type filter60Type_;
+
   /**
    * Reverberator
    */
   reverb* rv_;
 
+  /**
+   * Schroeder reverberator
+   */
+  schroederReverb* sr_;
+
+  /**
+   * Feedback delay network reverberator
+   */
+  fdnReverb* fd_;
+
+  /**
+   * Multi-tap delay
+   */
+  multiTap* mt_;
+
+  /**
+   * Reverberation engine in use
+   */
+  reverbType reverbType_;
+
   fir* fFilt_;
 
   fileManager* fm_;
@@ -154,6 +405,17 @@ protected:
    */
   int bufferSize_;
 
+  /**
+   * Buffer size given at init(), which is the size of scratch_ and of the
+   * largest span processed at once
+   */
+  int maxBlockSize_;
+
+  /**
+   * Working buffer of the stages, used alternately with the output
+   */
+  float* scratch_;
+
   /**
    * Equalizer on or off
    */
@@ -169,9 +431,173 @@ protected:
    */
   bool reverbOn_;
 
+  /**
+   * Multi-tap delay on or off
+   */
+  bool multiTapOn_;
+
   bool firOn_;
 
   bool wfOn_;
+
+  /**
+   * Half precision storage for delay lines and spectra
+   */
+  bool halfPrecision_;
+
+  /**
+   * @name Silence gates, used to skip stages whose input is silent and
+   * whose tail has already decayed
+   */
+  //{
+  silenceGate rvGate_;
+  silenceGate mtGate_;
+  silenceGate ffGate_;
+  silenceGate cfGate_;
+  silenceGate hcGate_;
+  //}
+
+  /**
+   * Relative level at which the tail of a stage is considered decayed
+   */
+  static const float TailEpsilon;
+
+  /**
+   * Number of samples the reverberation engine in use needs to decay
+   * below TailEpsilon
+   */
+  int reverbTailLength() const;
+
+  /**
+   * Parameter change for the processing thread
+   */
+  struct command {
+    commandId id;
+    int value;     /**< flag or type */
+    float param;   /**< continuous value */
+    float param2;  /**< second continuous value */
+    int64_t frame; /**< frame at which it takes effect */
+  };
+
+  /**
+   * Some constants
+   */
+  enum {
+    Immediately=-1, /**< frame of commands without time stamp */
+    MaxPending=256  /**< capacity of the pending command list */
+  };
+
+  /**
+   * Queue a command for the processing thread.  Returns false if the
+   * queue is full and the command was dropped.
+   */
+  bool post(commandId id,int value=0,float param=0.0f,float param2=0.0f);
+
+  /**
+   * Push a command into the queue.  Returns false if the queue is full.
+   */
+  bool push(const command& cmd);
+
+  /**
+   * Apply all queued commands that are already due (processing thread
+   * only)
+   */
+  void applyCommands();
+
+  /**
+   * Move the queued commands to the pending list (processing thread only)
+   */
+  void collectCommands();
+
+  /**
+   * Apply the pending commands due at the frame now or before.  Returns
+   * the frame of the next pending command, or end if it comes later
+   * (processing thread only).
+   */
+  int64_t applyDueCommands(int64_t now,int64_t end);
+
+  /**
+   * Apply one command.  Returns true if the reverberation parameters
+   * changed (processing thread only).
+   */
+  bool apply(const command& cmd);
+
+  /**
+   * Process a span of the block with constant parameters
+   */
+  void processSpan(const float* in,float* out,int n);
+
+  /**
+   * Publish the parameters of all reverberation engines for the getters
+   * (processing thread only)
+   */
+  void updateSnapshots();
+
+  /**
+   * Reset the reverberation engine in use (processing thread only)
+   */
+  void resetReverbState();
+
+  /**
+   * Commands from the GUI thread to the processing thread
+   */
+  spscQueue<command,256> commands_;
+
+  /**
+   * Commands taken from the queue which are not due yet, sorted by frame
+   * (processing thread only)
+   */
+  command pending_[MaxPending];
+
+  /**
+   * Number of commands in pending_
+   */
+  int pendingCount_;
+
+  /**
+   * Frames processed so far (processing thread only)
+   */
+  int64_t frameTime_;
+
+  /**
+   * Copy of frameTime_ for the other threads
+   */
+  std::atomic<int64_t> frameTimeSnapshot_;
+
+  /**
+   * @name Snapshots for the GUI thread
+   */
+  //{
+  /**
+   * Engine types as requested by the GUI thread, which may not have been
+   * applied yet
+   */
+  std::atomic<int> requestedReverbType_;
+  std::atomic<int> requestedFilter60Type_;
+
+  /**
+   * Alpha and delay of each reverberation engine
+   */
+  std::atomic<float> alphaSnapshot_[FDNReverb+1];
+  std::atomic<float> delaySnapshot_[FDNReverb+1];
+  //}
+
+  /**
+   * Reset the state of the given stage
+   */
+  void resetStage(stageId stage);
+
+  /**
+   * Replace the non-finite samples in the output of a stage by zeros.  If
+   * any is found, the stage is reset, since its state is probably
+   * contaminated, and an event is reported.
+   */
+  void sanitize(stageId stage,float* buffer,int n);
+
+  /**
+   * Events from the real-time thread to the GUI thread
+   */
+  spscQueue<sanitizerEvent,64> events_;
 };
 
 #endif // DSPSYSTEM_H
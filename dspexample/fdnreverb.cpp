@@ -0,0 +1,333 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   fdnreverb.cpp
+ *         Implements a feedback delay network reverberator
+ * \author Pablo Alvarado
+ * \date   2011.10.16
+ *
+ * $Id: fdnreverb.cpp $
+ */
+
+#include "fdnreverb.h"
+#include "simd.h"
+#include <cmath>
+#include <cstring>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// As for the Schroeder reverberator, the line delays are short compared
+// to the simple reverb, which keeps the interleaved ring buffer small
+
+const float fdnReverb::MaxDelay = 200.0f;
+
+#ifdef __AVX2__
+namespace {
+  /*
+   * Walsh-Hadamard transform of the 8 values in v (not normalized).
+   *
+   * Each stage computes the butterflies (a+b,a-b) of elements at distance
+   * 1, 2 and 4, with a permutation and a blend.
+   */
+  inline __m256 fwht8(__m256 v) {
+    __m256 t = _mm256_permute_ps(v,0xB1);             // distance 1
+    v = _mm256_blend_ps(_mm256_add_ps(v,t),_mm256_sub_ps(t,v),0xAA);
+    t = _mm256_permute_ps(v,0x4E);                    // distance 2
+    v = _mm256_blend_ps(_mm256_add_ps(v,t),_mm256_sub_ps(t,v),0xCC);
+    t = _mm256_permute2f128_ps(v,v,0x01);             // distance 4
+    v = _mm256_blend_ps(_mm256_add_ps(v,t),_mm256_sub_ps(t,v),0xF0);
+    return v;
+  }
+
+  /*
+   * Horizontal sum of the 8 values in v
+   */
+  inline float hsum8(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v),
+                          _mm256_extractf128_ps(v,1));
+    s = _mm_add_ps(s,_mm_movehl_ps(s,s));
+    s = _mm_add_ss(s,_mm_shuffle_ps(s,s,1));
+    return _mm_cvtss_f32(s);
+  }
+}
+#endif
+
+fdnReverb::fdnReverb(int lines)
+  : lines_((lines>8) ? 16 : 8),ringBuffer_(0),ringBufferSize_(0),idx_(0),
+    delay_(0.0f),alpha_(0.0f),damping_(0.2f),wet_(0.5f),sampleRate_(0) {
+  for (int i=0;i<MaxLines;++i) {
+    k_[i]=1;
+    gain_[i]=0.0f;
+    lowpass_[i]=0.0f;
+  }
+}
+
+/*
+ * Destructor
+ */
+fdnReverb::~fdnReverb() {
+  delete[] ringBuffer_;
+  ringBufferSize_=0;
+}
+
+/*
+ * Smallest prime number larger or equal than n
+ */
+int fdnReverb::nextPrime(int n) {
+  if (n<=2) {
+    return 2;
+  }
+  if ((n%2)==0) {
+    ++n;
+  }
+  for (;;n+=2) {
+    bool prime=true;
+    for (int d=3;d*d<=n;d+=2) {
+      if ((n%d)==0) {
+        prime=false;
+        break;
+      }
+    }
+    if (prime) {
+      return n;
+    }
+  }
+}
+
+/*
+ * Init the filter operation
+ */
+void fdnReverb::init(int sampleRate,
+                     float delay,
+                     float alpha) {
+
+  if (sampleRate!=sampleRate_) {
+    sampleRate_=sampleRate;
+
+    // leave some room for the primes above the maximal delay
+    int k = MaxDelay*sampleRate_/1000.0f + 2*lines_;
+
+    // find the next base-2 number that can hold the required sample number
+    ringBufferSize_ = 1 << static_cast<int>(ceil(log(k+1)/log(2.0f)));
+    delete[] ringBuffer_;
+    ringBuffer_ = new float[ringBufferSize_*lines_];
+  }
+
+  reset(); /* initial conds. 0 */
+
+  setDelay(delay);
+  setAlpha(alpha);
+}
+
+void fdnReverb::setAlpha(float alpha) {
+  alpha_ = (alpha<0.0f) ? 0.0f : (alpha>0.999f) ? 0.999f : alpha;
+  updateGains();
+}
+
+void fdnReverb::setDamping(float damping) {
+  damping_ = (damping<0.0f) ? 0.0f : (damping>1.0f) ? 1.0f : damping;
+}
+
+void fdnReverb::setMix(float wet) {
+  wet_ = (wet<0.0f) ? 0.0f : (wet>1.0f) ? 1.0f : wet;
+}
+
+void fdnReverb::setDelay(float delay) {
+  // ensure the set delay is valid
+  if (delay>MaxDelay) {
+    delay=MaxDelay;
+  }
+
+  const float longest = delay*sampleRate_/1000.0f;
+
+  // spread the lines geometrically between half the longest delay and the
+  // longest one, moving them to different primes
+  int last=1;
+  for (int i=0;i<lines_;++i) {
+    const float f = pow(2.0f,float(i-(lines_-1))/float(lines_-1));
+    int d = nextPrime(static_cast<int>(longest*f+0.5f));
+    if (d<=last) {
+      d=nextPrime(last+1);
+    }
+    k_[i]=last=d;
+  }
+
+  delay_ = 1000.0f*float(k_[lines_-1])/float(sampleRate_);
+  updateGains();
+}
+
+/*
+ * All lines have to decay at the same rate: alpha every k_[lines_-1]
+ * samples
+ */
+void fdnReverb::updateGains() {
+  const float kmax = float(k_[lines_-1]);
+  for (int i=0;i<lines_;++i) {
+    gain_[i] = pow(alpha_,float(k_[i])/kmax);
+  }
+}
+
+/**
+ * Filter the in buffer and leave the result in out
+ */
+void fdnReverb::filter(int blockSize,
+                       const float* in,
+                       float* out) {
+
+  // the following works because the ringBuffer was set with a size
+  // equal to 2^n.
+  const int mask = ringBufferSize_-1;
+  const float damp1 = damping_;
+  const float damp2 = 1.0f-damping_;
+  const float dry = 1.0f-wet_;
+  const float norm = 1.0f/sqrt(float(lines_));
+  const float outNorm = wet_/lines_;
+
+#ifdef __AVX2__
+  const int blocks = lines_/8;
+  const __m256i vmask = _mm256_set1_epi32(mask);
+  const __m256i shift = _mm256_set1_epi32(lines_==16 ? 4 : 3);
+  const __m256 vdamp1 = _mm256_set1_ps(damp1);
+  const __m256 vdamp2 = _mm256_set1_ps(damp2);
+  const __m256 vnorm  = _mm256_set1_ps(norm);
+  // output taps with alternating signs
+  const __m256 taps   = _mm256_setr_ps(1,-1,1,-1,1,-1,1,-1);
+
+  __m256i lane[2];
+  __m256i vk[2];
+  __m256 gain[2];
+  __m256 lp[2];
+  for (int b=0;b<blocks;++b) {
+    lane[b] = _mm256_add_epi32(_mm256_setr_epi32(0,1,2,3,4,5,6,7),
+                               _mm256_set1_epi32(8*b));
+    vk[b]   = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(k_+8*b));
+    gain[b] = _mm256_loadu_ps(gain_+8*b);
+    lp[b]   = _mm256_loadu_ps(lowpass_+8*b);
+  }
+#endif
+
+  for (int n=0;n<blockSize;++n) {
+    float* w = ringBuffer_+idx_*lines_;
+    float acc;
+
+#ifdef __AVX2__
+    const __m256i vidx = _mm256_set1_epi32(idx_);
+    __m256 a[2];
+    __m256 sum = _mm256_setzero_ps();
+    for (int b=0;b<blocks;++b) {
+      // d_i(n) is at ((n-k_i)&mask)*lines_+i
+      __m256i nmk = _mm256_and_si256(_mm256_sub_epi32(vidx,vk[b]),vmask);
+      nmk = _mm256_add_epi32(_mm256_sllv_epi32(nmk,shift),lane[b]);
+      const __m256 d = _mm256_i32gather_ps(ringBuffer_,nmk,4);
+
+      sum = _mm256_add_ps(sum,_mm256_mul_ps(taps,d));
+
+      // absorption
+      lp[b] = simd::flushDenormal(_mm256_add_ps(_mm256_mul_ps(d,vdamp2),
+                                                _mm256_mul_ps(lp[b],vdamp1)));
+      a[b] = fwht8(_mm256_mul_ps(gain[b],lp[b]));
+    }
+    if (blocks==2) {
+      // last Hadamard stage of 16 lines: distance 8, between registers
+      const __m256 lo = a[0];
+      a[0] = _mm256_add_ps(lo,a[1]);
+      a[1] = _mm256_sub_ps(lo,a[1]);
+    }
+    const __m256 x = _mm256_set1_ps(in[n]);
+    for (int b=0;b<blocks;++b) {
+      _mm256_storeu_ps(w+8*b,_mm256_add_ps(_mm256_mul_ps(vnorm,a[b]),x));
+    }
+    acc = hsum8(sum);
+#else
+    float a[MaxLines];
+    acc = 0.0f;
+    for (int i=0;i<lines_;++i) {
+      const int nmk=(idx_-k_[i]) & mask; // performing modulo with bitwise and
+      const float d = ringBuffer_[nmk*lines_+i];
+      acc += (i&1) ? -d : d;
+      lowpass_[i] = simd::flushDenormal(damp2*d + damp1*lowpass_[i]);
+      a[i] = gain_[i]*lowpass_[i];
+    }
+
+    // in-place fast Walsh-Hadamard transform
+    for (int h=1;h<lines_;h*=2) {
+      for (int i=0;i<lines_;i+=2*h) {
+        for (int j=i;j<i+h;++j) {
+          const float u=a[j];
+          const float v=a[j+h];
+          a[j]=u+v;
+          a[j+h]=u-v;
+        }
+      }
+    }
+
+    for (int i=0;i<lines_;++i) {
+      w[i] = norm*a[i] + in[n];
+    }
+#endif
+
+    out[n] = dry*in[n] + outNorm*acc;
+    idx_ = (idx_+1) & mask;
+  }
+
+#ifdef __AVX2__
+  for (int b=0;b<blocks;++b) {
+    _mm256_storeu_ps(lowpass_+8*b,lp[b]);
+  }
+#endif
+}
+
+/*
+ * Reset
+ */
+void fdnReverb::reset() {
+  /* initial conds. 0 */
+  memset(ringBuffer_,0,sizeof(float)*ringBufferSize_*lines_);
+  for (int i=0;i<MaxLines;++i) {
+    lowpass_[i]=0.0f;
+  }
+  idx_=0;
+}
+
+/*
+ * Number of samples the output needs to decay below epsilon
+ */
+int fdnReverb::tailLength(float epsilon) const {
+  if (alpha_ <= 0.0f) {
+    return k_[lines_-1];
+  }
+  // the whole network decays by alpha every k_[lines_-1] samples
+  return static_cast<int>(ceil(log(epsilon)/log(alpha_))+1)*k_[lines_-1];
+}
+
+/*
+ * Return alpha value in use.
+ */
+float fdnReverb::getAlpha() const {
+  return alpha_;
+}
+
+/*
+ * Return delay value of the longest line in use, in miliseconds.
+ */
+float fdnReverb::getDelay() const {
+  return delay_;
+}
@@ -0,0 +1,217 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   fdnreverb.h
+ *         Implements a feedback delay network reverberator
+ * \author Pablo Alvarado
+ * \date   2011.10.16
+ *
+ * $Id: fdnreverb.h $
+ */
+
+#ifndef FDNREVERB_H
+#define FDNREVERB_H
+
+/**
+ * Feedback delay network reverberator
+ *
+ * N delay lines (8 or 16) of mutually prime lengths are fed back through
+ * an orthogonal mixing matrix.  The matrix is a normalized Hadamard matrix,
+ * applied with a fast Walsh-Hadamard transform (only additions and
+ * subtractions, N log N of them), computed inside the AVX registers that
+ * hold all the lines.
+ *
+ * Each line has an absorption filter (a gain and a one-pole lowpass),
+ * with the gain adjusted to the line length so that all lines decay at the
+ * same rate.  With x(n) the input, d_i(n) = s_i(n-k_i) the delayed line
+ * outputs and H the Hadamard matrix:
+ * \f[
+ * l_i(n) = (1-p) d_i(n) + p\,l_i(n-1) \qquad
+ * a_i(n) = g_i\,l_i(n) \qquad
+ * s(n) = \frac{1}{\sqrt{N}} H a(n) + x(n)
+ * \f]
+ *
+ * The cost per sample is fixed and independent of the reverberation time.
+ *
+ * As in the other reverberators, the lines share one power-of-two ring
+ * buffer, with the samples of all lines at a given time interleaved.
+ */
+class fdnReverb {
+public:
+  /**
+   * Constructor
+   *
+   * @param lines number of delay lines.  Must be 8 or 16.
+   */
+  fdnReverb(int lines=8);
+
+  /**
+   * Destructor
+   */
+  ~fdnReverb();
+
+  /**
+   * Init the filter operation
+   *
+   * @param sampleRate used sample rate
+   * @param delay delay of the longest line in ms.  The other lines are
+   *              spread down to half of this value.  This value must be
+   *              less than MaxDelay.
+   * @param alpha attenuation of the signal every time it runs through the
+   *              longest line.  Must be between 0 and 1.
+   */
+  void init(int sampleRate,
+            float delay,
+            float alpha);
+
+  /**
+   * Filter the in buffer and leave the result in out
+   */
+  void filter(int blockSize,
+              const float* in,
+              float* out);
+
+  /**
+   * Return alpha value in use.
+   */
+  float getAlpha() const;
+
+  /**
+   * Return delay value of the longest line in use, in miliseconds.
+   */
+  float getDelay() const;
+
+  /**
+   * Set alpha value in use.
+   */
+  void setAlpha(float alpha);
+
+  /**
+   * Set delay value of the longest line, in miliseconds.
+   */
+  void setDelay(float delay);
+
+  /**
+   * Set damping factor (between 0 and 1) of the absorption lowpass filters
+   */
+  void setDamping(float damping);
+
+  /**
+   * Set the amount of reverberated signal in the output (between 0 and 1)
+   */
+  void setMix(float wet);
+
+  /**
+   * Reset reverberator
+   */
+  void reset();
+
+  /**
+   * Number of samples the output needs to decay below epsilon times the
+   * level of the last input, after the input becomes silent
+   */
+  int tailLength(float epsilon) const;
+
+  /**
+   * Constant that defines what is the maximum delay allowed in ms
+   */
+  static const float MaxDelay;
+
+  /**
+   * Some constants
+   */
+  enum {
+    MaxLines=16
+  };
+
+protected:
+  /**
+   * Number of delay lines
+   */
+  int lines_;
+
+  /**
+   * Ring buffer of the delay lines, with lines_ lines interleaved.
+   *
+   * This will have a 2^n*lines_ size to facilitate the modulo computation
+   */
+  float* ringBuffer_;
+
+  /**
+   * Ring buffer size (in samples per line)
+   */
+  int ringBufferSize_;
+
+  /**
+   * Index of the last processed data in the ring buffer
+   */
+  int idx_;
+
+  /**
+   * Delay of each line
+   */
+  int k_[MaxLines];
+
+  /**
+   * Absorption gain of each line
+   */
+  float gain_[MaxLines];
+
+  /**
+   * State of the absorption lowpass of each line
+   */
+  float lowpass_[MaxLines];
+
+  /**
+   * Delay of the longest line in ms
+   */
+  float delay_;
+
+  /**
+   * Alpha coefficient
+   */
+  float alpha_;
+
+  /**
+   * Damping of the absorption lowpass filters
+   */
+  float damping_;
+
+  /**
+   * Wet amount in the output
+   */
+  float wet_;
+
+  /**
+   * Sample rate
+   */
+  int sampleRate_;
+
+  /**
+   * Recompute the absorption gains after a change of alpha or the delays
+   */
+  void updateGains();
+
+  /**
+   * Smallest prime number larger or equal than n
+   */
+  static int nextPrime(int n);
+};
+
+#endif // FDNREVERB_H
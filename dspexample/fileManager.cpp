@@ -7,6 +7,10 @@
 
 #include"fileManager.h"
 
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
 #undef _DSP_DEBUG
 #define _DSP_DEBUG
 
@@ -17,39 +21,144 @@
 #define _debug(x)
 #endif
 
-fileManager::fileManager()
+fileManager::fileManager() : archivo_(-1), offset_(0), actual_(-1), usado_(0),
+	descartados_(0), hilo_(this), salir_(false)
 {
-
+	asyncIO& io=asyncIO::instance();
+	for (int i=0;i<Buffers;++i)
+	{
+		bloques_[i].bufferIndex=io.acquireBuffer();
+		if (bloques_[i].bufferIndex>=0)
+			bloques_[i].buffer=io.buffer(bloques_[i].bufferIndex);
+		else
+			bloques_[i].buffer=new char[asyncIO::BufferSize];
+		libres_.push(i);
+	}
 }
 
 fileManager::~fileManager()
 {
-	fclose(archivo_);
+	closeFile();
+	if (descartados_>0)
+		_debug("Se descartaron " << descartados_ << " lineas de valores\n");
+	if (archivo_>=0)
+		close(archivo_);
+
+	asyncIO& io=asyncIO::instance();
+	for (int i=0;i<Buffers;++i)
+	{
+		if (bloques_[i].bufferIndex>=0)
+			io.releaseBuffer(bloques_[i].bufferIndex);
+		else
+			delete[] bloques_[i].buffer;
+	}
 	_debug("Cerrando el archivo de valores procesados por el filtro\n");
 }
 
 void fileManager::initFile(char* nombre)
 {
-	archivo_ = fopen(nombre,"a+");
+	archivo_ = open(nombre,O_WRONLY|O_CREAT,0644);
+	offset_ = (archivo_>=0) ? lseek(archivo_,0,SEEK_END) : 0;
+	if (!hilo_.isRunning())
+		hilo_.start();
 	_debug("Archivo de valores procesados por el filtro creado\n");
 }
 
+void fileManager::append(const char* texto, int n, bool esperar)
+{
+	if ((actual_>=0) && (usado_+n>asyncIO::BufferSize))
+		flush();
+
+	// sin hilo de escritura no se libera ningun bloque
+	esperar = esperar && hilo_.isRunning();
+	while ((actual_<0) && !libres_.pop(actual_))
+	{
+		actual_=-1;
+		if (!esperar)
+		{
+			// el texto se descarta
+			++descartados_;
+			return;
+		}
+		usleep(1000);
+	}
+	memcpy(bloques_[actual_].buffer+usado_,texto,n);
+	usado_+=n;
+}
+
+void fileManager::flush()
+{
+	if (actual_<0)
+		return;
+
+	if (usado_==0)
+	{
+		libres_.push(actual_);
+	}
+	else
+	{
+		bloques_[actual_].size=usado_;
+		llenos_.push(actual_);
+	}
+	actual_=-1;
+	usado_=0;
+}
+
+void fileManager::escritor::run()
+{
+	while (!fm_->salir_.load())
+	{
+		fm_->escribir();
+		usleep(10000);
+	}
+	// los ultimos bloques
+	fm_->escribir();
+}
+
+void fileManager::escribir()
+{
+	asyncIO& io=asyncIO::instance();
+	int i;
+	while (llenos_.pop(i))
+	{
+		asyncIO::request& r=bloques_[i];
+		if (archivo_>=0)
+		{
+			r.fd=archivo_;
+			r.offset=offset_;
+			r.write=true;
+			io.queue(r);
+			io.submit();
+			io.wait(r);
+			offset_+=r.size;
+		}
+		libres_.push(i);
+	}
+}
+
 void fileManager::writeln(int blockSize, float* in)
 {
+	char linea[64];
 	for(int n=0;n<blockSize;++n)
-	fprintf(archivo_,"%2.15f\n",in[n]);
+	append(linea,snprintf(linea,sizeof(linea),"%2.15f\n",in[n]),true);
 }
 
 void fileManager::writeFile(int blockSize, float* in, float* out)
 {
-	_debug("Escribiendo en el archivo de valores procesados por el filtro\n");
+	char linea[128];
 	for (int n=0;n<blockSize;++n)
 	{
-		fprintf(archivo_,"%d		%f		%f\n",n, in[n], out[n]);
+		append(linea,snprintf(linea,sizeof(linea),"%d		%f		%f\n",n, in[n], out[n]),false);
 	}
 }
 
 void fileManager::closeFile()
 {
-
+	flush();
+	if (hilo_.isRunning())
+	{
+		salir_=true;
+		hilo_.wait();
+		salir_=false;
+	}
 }
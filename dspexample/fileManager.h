@@ -12,6 +12,21 @@
 #include <iostream>
 #include <string>
 
+#include <atomic>
+#include <QThread>
+
+#include "asyncio.h"
+#include "spscqueue.h"
+
+/*
+ * Los valores se escriben como texto en bloques de memoria.  Los bloques
+ * llenos pasan por una cola sin bloqueo a un hilo de escritura, que los
+ * envia al archivo con asyncIO y los devuelve vacios.
+ *
+ * writeFile() se llama desde el hilo de JACK y nunca espera: si no hay
+ * bloque libre, el texto se descarta.  writeln() se usa desde hilos que
+ * no son de tiempo real, y espera a que haya un bloque libre.
+ */
 class fileManager
 {
 public:
@@ -28,7 +43,75 @@ public:
 	void closeFile();
 
 private:
-	FILE* archivo_;
+	/*
+	 * Hilo que escribe los bloques llenos en el archivo
+	 */
+	class escritor : public QThread
+	{
+	public:
+		escritor(fileManager* fm) : fm_(fm) {}
+		virtual void run();
+	protected:
+		fileManager* fm_;
+	};
+
+	friend class escritor;
+
+	/*
+	 * Agrega el texto al bloque actual.  Si no hay bloque libre, espera
+	 * a que el hilo de escritura libere uno, o descarta el texto.
+	 */
+	void append(const char* texto, int n, bool esperar);
+
+	/*
+	 * Pasa el bloque actual al hilo de escritura
+	 */
+	void flush();
+
+	/*
+	 * Escribe los bloques llenos (hilo de escritura)
+	 */
+	void escribir();
+
+	enum
+	{
+		Buffers=4
+	};
+
+	int archivo_;
+
+	/*
+	 * Posicion en el archivo del siguiente bloque (hilo de escritura)
+	 */
+	long long offset_;
+
+	/*
+	 * Bloques de texto y sus escrituras
+	 */
+	asyncIO::request bloques_[Buffers];
+
+	/*
+	 * Indices de los bloques listos para escribir, y de los vacios
+	 */
+	spscQueue<int,Buffers> llenos_;
+	spscQueue<int,Buffers> libres_;
+
+	/*
+	 * Bloque que se esta llenando (-1 si no hay), y bytes usados en el
+	 */
+	int actual_;
+	int usado_;
+
+	/*
+	 * Lineas de texto descartadas por falta de bloques libres
+	 */
+	int descartados_;
+
+	/*
+	 * Hilo de escritura, y pedido de terminarlo
+	 */
+	escritor hilo_;
+	std::atomic<bool> salir_;
 protected:
 
 };
@@ -28,7 +28,7 @@ fir::~fir()
 
 }
 
-void fir::filterFir(int blockSize, float* in, float* out)
+void fir::filterFir(int blockSize, const float* in, float* out)
 {
 	_debug("Filtrando con el FIR.\n");
 }
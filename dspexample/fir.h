@@ -27,7 +27,7 @@ class fir
 
 	  void initFir();
 
-	  void filterFir(int blockSize, float* in, float* out);
+	  void filterFir(int blockSize, const float* in, float* out);
 
 	protected:
 };
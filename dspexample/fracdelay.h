@@ -0,0 +1,215 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   fracdelay.h
+ *         Fractional delay reads and block-ramped parameters
+ * \author Pablo Alvarado
+ * \date   2011.10.17
+ *
+ * $Id: fracdelay.h $
+ */
+
+#ifndef FRACDELAY_H
+#define FRACDELAY_H
+
+#include <cmath>
+#include "simd.h"
+
+/**
+ * Parameter that changes linearly over one block towards a new target,
+ * instead of jumping to it, to avoid zipper noise.
+ *
+ * The target can be changed at any time.  At the beginning of each block
+ * the filter calls begin(), and if the value is ramping it takes one value
+ * per sample with next().  The target is reached exactly at the end of the
+ * block.
+ */
+class rampedValue {
+public:
+  rampedValue(float value=0.0f)
+    : value_(value),target_(value),end_(value),step_(0.0f),steps_(0) {
+  }
+
+  /**
+   * Set the value immediately, without ramp
+   */
+  void jump(float value) {
+    value_=target_=value;
+    steps_=0;
+  }
+
+  /**
+   * Set the value reached at the end of the next block
+   */
+  void set(float value) {
+    target_=value;
+  }
+
+  /**
+   * Value reached at the end of the ramp
+   */
+  float target() const {
+    return target_;
+  }
+
+  /**
+   * Current value
+   */
+  float value() const {
+    return value_;
+  }
+
+  /**
+   * Prepare a block of the given size.
+   *
+   * @return true if the value changes within the block
+   */
+  bool begin(int blockSize) {
+    const float target=target_; // it may change concurrently
+    if ((target==value_) || (blockSize<=0)) {
+      steps_=0;
+      return false;
+    }
+    step_=(target-value_)/blockSize;
+    steps_=blockSize;
+    end_=target;
+    return true;
+  }
+
+  /**
+   * Advance one sample of the ramp, and return the new value
+   */
+  float next() {
+    if (steps_>0) {
+      value_ = (--steps_==0) ? end_ : value_+step_;
+    }
+    return value_;
+  }
+
+protected:
+  float value_;
+  float target_;
+  float end_;
+  float step_;
+  int steps_;
+};
+
+/**
+ * Fractional delay reads from a masked ring buffer.
+ *
+ * A delay D=i+f, with i integer and f in [0,1), is read with a third order
+ * Lagrange interpolator over the samples delayed i-1, i, i+1 and i+2, so
+ * that the interpolation point lies in the central interval, where the
+ * interpolator is most accurate.  Since the newest sample involved is
+ * delayed i-1, recursive filters need delays of at least MinDelay.
+ *
+ * The ring buffer may hold float or half precision (uint16_t) samples.
+ */
+class fracDelay {
+public:
+  enum {
+    MinDelay=2, /**< Shortest delay usable in a recursive filter */
+    Span=4      /**< Number of samples involved in each read */
+  };
+
+  /**
+   * Split the delay in the integer part i and the four interpolation
+   * coefficients, for the samples delayed i-1, i, i+1 and i+2
+   */
+  static inline int coefficients(const float delay,float* c) {
+    const int i=static_cast<int>(floorf(delay));
+    const float x=1.0f+(delay-i);  // position relative to the node i-1
+    const float xm1=x-1.0f;
+    const float xm2=x-2.0f;
+    const float xm3=x-3.0f;
+    c[0]=-xm1*xm2*xm3*(1.0f/6.0f);
+    c[1]=x*xm2*xm3*0.5f;
+    c[2]=-x*xm1*xm3*0.5f;
+    c[3]=x*xm1*xm2*(1.0f/6.0f);
+    return i;
+  }
+
+  /**
+   * Read the sample delayed delay samples from the one at idx
+   */
+  template<typename S>
+  static inline float read(const S* ring,
+                           const int mask,
+                           const int idx,
+                           const float delay) {
+    float c[Span];
+    const int i=coefficients(delay,c);
+    return read(ring,mask,idx,i,c);
+  }
+
+  /**
+   * Read the sample delayed by the integer part i and coefficients c
+   * given by coefficients()
+   */
+  template<typename S>
+  static inline float read(const S* ring,
+                           const int mask,
+                           const int idx,
+                           const int i,
+                           const float* c) {
+    const int p=idx-i+1;
+    return c[0]*simd::load(ring+(p & mask))     +
+           c[1]*simd::load(ring+((p-1) & mask)) +
+           c[2]*simd::load(ring+((p-2) & mask)) +
+           c[3]*simd::load(ring+((p-3) & mask));
+  }
+
+#ifdef __SSE__
+  /**
+   * Read four consecutive samples with the same delay, i.e. the samples
+   * idx-D ... idx+3-D.
+   *
+   * The caller must ensure that the positions idx-i-2 to idx-i+4 do not
+   * wrap around the end of the ring (no mask is applied).
+   *
+   * @param c the four coefficients returned by coefficients(), each one
+   *          broadcast to a register
+   */
+  template<typename S>
+  static inline __m128 read4(const S* ring,
+                             const int idx,
+                             const int i,
+                             const __m128* c) {
+    const S* p=ring+idx-i+1;
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0],simd::load4(p)),
+                                 _mm_mul_ps(c[1],simd::load4(p-1))),
+                      _mm_add_ps(_mm_mul_ps(c[2],simd::load4(p-2)),
+                                 _mm_mul_ps(c[3],simd::load4(p-3))));
+  }
+#endif
+
+  /**
+   * True if four samples starting at idx can be processed with read4() in
+   * a recursive filter with the integer delay i: the values read must be
+   * already computed and no access may wrap around the ring of the given
+   * size.
+   */
+  static inline bool vectorizable(const int ringSize,
+                                  const int idx,
+                                  const int i) {
+    return (i>4) && (idx+4<=ringSize) && (idx-i-2>=0);
+  }
+};
+
+#endif // FRACDELAY_H
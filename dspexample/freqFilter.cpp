@@ -38,6 +38,9 @@
 #define _debug(x)
 #endif
 
+
+#include "simd.h"
+
 /**
  * Get the minimum of two numbers
  */
@@ -52,14 +55,58 @@ int freqFilter::max(const int a,const int b) const {
   return (a>b) ? a : b;
 }
 
-inline void freqFilter::mul(fftwf_complex& X,
-                            const fftwf_complex& H) const {
-  float re,im;
-  re=X[0]*H[0]-X[1]*H[1];
-  im=X[0]*H[1]+X[1]*H[0];
+/*
+ * Multiply Xw_ and Hw_.
+ *
+ * With the split layout this is a sequence of vertical multiply-adds,
+ * without any shuffling of real and imaginary parts.
+ */
+template<typename S>
+inline void freqFilter::mul(const S* HwRe,const S* HwIm) {
+  const int bins = HwSize_/2+1;
+  int n=0;
+
+#ifdef __SSE__
+  for (;n+4<=bins;n+=4) {
+    const __m128 xr=_mm_loadu_ps(XwRe_+n);
+    const __m128 xi=_mm_loadu_ps(XwIm_+n);
+    const __m128 hr=simd::load4(HwRe+n);
+    const __m128 hi=simd::load4(HwIm+n);
+    _mm_storeu_ps(XwRe_+n,_mm_sub_ps(_mm_mul_ps(xr,hr),_mm_mul_ps(xi,hi)));
+    _mm_storeu_ps(XwIm_+n,_mm_add_ps(_mm_mul_ps(xr,hi),_mm_mul_ps(xi,hr)));
+  }
+#endif
 
-  X[0]=re;
-  X[1]=im;
+  for (;n<bins;++n) {
+    const float hr=simd::load(HwRe+n);
+    const float hi=simd::load(HwIm+n);
+    const float re=XwRe_[n]*hr-XwIm_[n]*hi;
+    const float im=XwRe_[n]*hi+XwIm_[n]*hr;
+    XwRe_[n]=re;
+    XwIm_[n]=im;
+  }
+}
+
+/*
+ * Set one bin of the frequency response being prepared
+ */
+inline void freqFilter::setBin(const int k,const float re,const float im) {
+  const int i = back_*(HwSize_/2+1)+k;
+  if (HwReHalf_!=0) {
+    HwReHalf_[i]=simd::toHalf(re);
+    HwImHalf_[i]=simd::toHalf(im);
+  } else {
+    HwRe_[i]=re;
+    HwIm_[i]=im;
+  }
+}
+
+/*
+ * Hand the prepared response over to filter(), and take the slot released
+ * by it (or the one published before and never used) for the next one
+ */
+void freqFilter::publish() {
+  back_ = latest_.exchange(back_ | Dirty,std::memory_order_acq_rel) & SlotMask;
 }
 
 
@@ -67,121 +114,180 @@ inline void freqFilter::mul(fftwf_complex& X,
  * Constructor
  *
  * @param blockSize size of the data blocks to be filtered
+ * @param halfPrecision store the frequency response in half precision
  */
-freqFilter::freqFilter(int blockSize)
-  : blockSize_(blockSize),HwSize_(0),hnSize_(0),
-    Hw_(0),Xw_(0),xn_(0),yn_(0) {
+freqFilter::freqFilter(int blockSize,bool halfPrecision)
+  : blockSize_(blockSize),halfPrecision_(halfPrecision),HwSize_(0),hnSize_(0),
+    fft_(0),ifft_(0),smallFft_(0),smallIfft_(0),HwRe_(0),HwIm_(0),
+    HwReHalf_(0),HwImHalf_(0),front_(0),back_(1),latest_(2),
+    XwRe_(0),XwIm_(0),hist_(0),pos_(0),xn_(0),yn_(0) {
 }
 
 /*
  * Destructor
  */
 freqFilter::~freqFilter() {
-
+  clear();
   blockSize_=0;
-  HwSize_=0;
-  hnSize_=0;
-
-  fftwf_destroy_plan(fft_);
-  fftwf_destroy_plan(ifft_);
+}
 
-  fftwf_free(Hw_);
-  Hw_=0;
+/*
+ * Release all buffers and plans
+ */
+void freqFilter::clear() {
+  if (fft_!=0) {
+    fftwf_destroy_plan(fft_);
+    fft_=0;
+  }
 
-  fftwf_free(Xw_);
-  Xw_=0;
+  if (ifft_!=0) {
+    fftwf_destroy_plan(ifft_);
+    ifft_=0;
+  }
 
-  fftwf_free(xn_);
+  fftwf_free(HwRe_);
+  HwRe_=0;
+  fftwf_free(HwIm_);
+  HwIm_=0;
+  fftwf_free(HwReHalf_);
+  HwReHalf_=0;
+  fftwf_free(HwImHalf_);
+  HwImHalf_=0;
+
+  if (xn_!=XwRe_) {
+    fftwf_free(xn_);
+  }
   xn_=0;
 
-  fftwf_free(yn_);
+  if (yn_!=XwRe_) {
+    fftwf_free(yn_);
+  }
   yn_=0;
 
+  fftwf_free(XwRe_);
+  XwRe_=0;
+  fftwf_free(XwIm_);
+  XwIm_=0;
 
+  fftwf_free(hist_);
+  hist_=0;
+  pos_=0;
+
+  smallFft_=0;
+  smallIfft_=0;
+
+  HwSize_=0;
+  hnSize_=0;
 }
-  ;
 
 /*
- * Set the frequency response of the filter
+ * Allocate buffers and create the plans for the given sizes
  */
-void freqFilter::setFilter(fftwf_complex* Hw,
-                           int HwSize,
-                           int hnSize) {
-
-  if (HwSize != HwSize_) {
-
-    if (HwSize_>0) {
-      fftwf_destroy_plan(fft_);
-      fftwf_destroy_plan(ifft_);
-    }
-
-    if (Hw_!=0) {
-      fftwf_free(Hw_);
-      Hw_=0;
-    }
-
-    if (Xw_!=0) {
-      fftwf_free(Xw_);
-      Xw_=0;
-    }
-
-    if (xn_!=0) {
-      fftwf_free(xn_);
-      xn_=0;
-    }
-
-    if (yn_!=0) {
-      fftwf_free(yn_);
-      yn_=0;
-    }
+void freqFilter::resize(int HwSize,int hnSize) {
+  _debug("  set-up memory arrays" << std::endl);
+
+  clear();
+
+  HwSize_=HwSize;
+  hnSize_=hnSize;
+
+  // a real signal has a hermitian spectrum: only half of it is needed
+  const int bins = HwSize_/2+1;
+
+  // one slot in use by filter(), one being prepared, and one published
+  const int slots = Slots*bins;
+  if (halfPrecision_) {
+    HwReHalf_ = reinterpret_cast<uint16_t*>(fftwf_malloc(sizeof(uint16_t)*slots));
+    HwImHalf_ = reinterpret_cast<uint16_t*>(fftwf_malloc(sizeof(uint16_t)*slots));
+    memset(HwReHalf_,0,sizeof(uint16_t)*slots);
+    memset(HwImHalf_,0,sizeof(uint16_t)*slots);
+  } else {
+    HwRe_ = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*slots));
+    HwIm_ = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*slots));
+  }
+  front_=0;
+  back_=1;
+  latest_.store(2);
+  XwRe_ = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*HwSize_));
+  XwIm_ = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*bins));
+
+  // only the samples the next block needs are kept
+  hist_ = reinterpret_cast<float*>
+          (fftwf_malloc(sizeof(float)*max(hnSize_-1,1)));
+
+  // guru interface, to work with separate real and imaginary arrays
+  fftwf_iodim dim;
+  dim.n  = HwSize_;
+  dim.is = 1;
+  dim.os = 1;
+
+  // the direct transform takes its input from its own real output array
+  xn_ = XwRe_;
+  fft_  = fftwf_plan_guru_split_dft_r2c(1,&dim,0,0,
+                                        xn_,XwRe_,XwIm_,FFTW_MEASURE);
+
+  if (fft_==0) {
+    _debug("  in-place direct plan not available" << std::endl);
+    xn_ = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*HwSize_));
+    fft_  = fftwf_plan_guru_split_dft_r2c(1,&dim,0,0,
+                                          xn_,XwRe_,XwIm_,FFTW_MEASURE);
+  }
 
-    HwSize_=HwSize;
-    hnSize_=hnSize;
+  // the inverse transform leaves its output on its own real input array
+  yn_ = XwRe_;
+  ifft_ = fftwf_plan_guru_split_dft_c2r(1,&dim,0,0,
+                                        XwRe_,XwIm_,yn_,FFTW_MEASURE);
 
-    Hw_ = reinterpret_cast<fftwf_complex*>
-          (fftwf_malloc(sizeof(fftwf_complex)*HwSize_));
+  if (ifft_==0) {
+    _debug("  in-place inverse plan not available" << std::endl);
+    yn_ = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*HwSize_));
+    ifft_ = fftwf_plan_guru_split_dft_c2r(1,&dim,0,0,
+                                          XwRe_,XwIm_,yn_,FFTW_MEASURE);
+  }
 
-    Xw_ = reinterpret_cast<fftwf_complex*>
-          (fftwf_malloc(sizeof(fftwf_complex)*HwSize_));
-    memset(Xw_,0,sizeof(float)*HwSize_);
+  // for small sizes the FFTW plans are only a fallback
+  smallFFTSelector::select(HwSize_,smallFft_,smallIfft_);
 
-    // Even if the size of h(n) is hnSize_, we use HwSize because zero
-    // padding is to be performed
-    xn_ = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*HwSize_));
-    memset(xn_,0,sizeof(float)*HwSize_);
+  // FFTW_MEASURE overwrites the arrays while planning
+  if (HwRe_!=0) {
+    memset(HwRe_,0,sizeof(float)*slots);
+    memset(HwIm_,0,sizeof(float)*slots);
+  }
+  memset(XwRe_,0,sizeof(float)*HwSize_);
+  memset(XwIm_,0,sizeof(float)*bins);
+  reset();
+}
 
-    yn_ = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*HwSize_));
-    memset(yn_,0,sizeof(float)*HwSize_);
+/*
+ * Set the frequency response of the filter
+ */
+void freqFilter::setFilter(fftwf_complex* Hw,
+                           int HwSize,
+                           int hnSize) {
 
-    fft_  = fftwf_plan_dft_r2c_1d(HwSize_,xn_,Xw_,FFTW_MEASURE);
-    ifft_ = fftwf_plan_dft_c2r_1d(HwSize_,Xw_,yn_,FFTW_MEASURE);
+  if (HwSize != HwSize_) {
+    resize(HwSize,hnSize);
   }
 
   // The FFTW does not automatically normalize the inverse transform.
   // We force the normalization inserting the normalization factor into the
   // filter itself
 
-#if 0 // set to zero to avoid dividing by HwSize_
-
-  const fftwf_complex* src = Hw;
-  const fftwf_complex *const srcEnd = src+HwSize_;
-  fftwf_complex* dest = Hw_;
-
-  while (src!=srcEnd) {
-    (*dest)[0]=(*src)[0]/HwSize_;
-    (*dest)[1]=(*src)[1]/HwSize_;
-
-    ++src;
-    ++dest;
-  }
+  const int bins = HwSize_/2+1;
 
+#if 0 // set to zero to avoid dividing by HwSize_
+  const float norm = 1.0f/HwSize_;
 #else
-
   // debug line avoiding normalization
-  memcpy(Hw_,Hw,sizeof(float)*HwSize_);
-
+  const float norm = 1.0f;
 #endif
 
+  // only the first half of the hermitian spectrum is kept, split in real
+  // and imaginary parts
+  for (int k=0;k<bins;++k) {
+    setBin(k,Hw[k][0]*norm,Hw[k][1]*norm);
+  }
+  publish();
 }
 
 /*
@@ -191,138 +297,138 @@ void freqFilter::setFilter(float* hn,int hnSize,int HwSize) {
   _debug(" freqFilter::setFilter()" << std::endl);
 
   if ((HwSize != HwSize_) || (hnSize != hnSize_)) {
-    _debug("  set-up memory arrays" << std::endl);
-
-    if (HwSize_>0) {
-      fftwf_destroy_plan(fft_);
-      fftwf_destroy_plan(ifft_);
-    }
-    if (Hw_!=0) {
-      fftwf_free(Hw_);
-      Hw_=0;
-    }
-
-    if (Xw_!=0) {
-      fftwf_free(Xw_);
-      Xw_=0;
-    }
-
-    if (xn_!=0) {
-      fftwf_free(xn_);
-      xn_=0;
-    }
-
-    if (yn_!=0) {
-      fftwf_free(yn_);
-      yn_=0;
-    }
-
-
-    HwSize_=HwSize;
-    hnSize_=hnSize;
-
-    Hw_ = reinterpret_cast<fftwf_complex*>
-          (fftwf_malloc(sizeof(fftwf_complex)*HwSize_));
-
-    Xw_ = reinterpret_cast<fftwf_complex*>
-          (fftwf_malloc(sizeof(fftwf_complex)*HwSize_));
-    memset(Xw_,0,sizeof(float)*HwSize_);
-
-    // Even if the size of h(n) is hnSize_, we use HwSize because zero
-    // padding is to be performed
-    xn_ = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*HwSize_));
-    yn_ = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*HwSize_));
-    memset(yn_,0,sizeof(float)*HwSize_);
-
-    fft_  = fftwf_plan_dft_r2c_1d(HwSize_,xn_,Xw_,FFTW_MEASURE);
-    ifft_ = fftwf_plan_dft_c2r_1d(HwSize_,Xw_,yn_,FFTW_MEASURE);
+    resize(HwSize,hnSize);
   }
 
   _debug("  computing frequency response of given impulse response\n");
 
-  memset(xn_,0,sizeof(float)*HwSize_); // zero padding
+  // the buffers of filter() cannot be used, since it may be running in
+  // another thread.  The plan is reused with new arrays, which have to be
+  // in place if the plan is.
+  const int bins = HwSize_/2+1;
+  float* re = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*HwSize_));
+  float* im = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*bins));
+  float* xn = (xn_==XwRe_) ? re :
+    reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*HwSize_));
+
+  memset(xn,0,sizeof(float)*HwSize_); // zero padding
 
   // first move the impulse response to x(n)
-  memcpy(xn_,hn,hnSize_);
+  memcpy(xn,hn,hnSize_*sizeof(float));
 
   // Compute the frequency response
-  fftwf_execute(fft_);
+  fftwf_execute_split_dft_r2c(fft_,xn,re,im);
 
   // The FFTW does not automatically normalize the inverse transform.
   // We force the normalization inserting the normalization factor into the
   // filter itself
 
 #if 1 // set to zero to avoid dividing by HwSize_
-
-  const fftwf_complex* src = Xw_;
-  const fftwf_complex *const srcEnd = src+HwSize_;
-  fftwf_complex* dest = Hw_;
-
-  while (src!=srcEnd) {
-    (*dest)[0]=(*src)[0]/HwSize_;
-    (*dest)[1]=(*src)[1]/HwSize_;
-
-    ++src;
-    ++dest;
-  }
-
+  const float norm = 1.0f/HwSize_;
 #else
-
   // debug line avoiding normalization
-  memcpy(Hw_,Xw_,sizeof(float)*HwSize_);
-
+  const float norm = 1.0f;
 #endif
+
+  for (int k=0;k<bins;++k) {
+    setBin(k,re[k]*norm,im[k]*norm);
+  }
+  publish();
+
+  if (xn!=re) {
+    fftwf_free(xn);
+  }
+  fftwf_free(im);
+  fftwf_free(re);
 }
 
 /*
  * Filter the input block of the given size and produce
  * the output of the same size considering past evaluations.
  */
-void freqFilter::filter(float* in,float* out) {
-  // we use overlap-save method
-
-  // the save-part first:
-  const int hnSize1 = (hnSize_-1);
-  // copy the last hnSize_-1 samples from the end of the last response to
-  // the very beginning
-  memcpy(xn_,xn_+blockSize_,hnSize1*sizeof(float));
-  // now copy the input block after the saved block
-  memcpy(xn_+hnSize1,in,blockSize_*sizeof(float));
-  // when the filter was set, the rest was set to zero.
+void freqFilter::filter(const float* in,float* out) {
+  filterBlock(in,out,blockSize_);
+}
 
-  fftwf_execute(fft_); // input to the frequency domain
+/*
+ * Filter any number of samples, in blocks of at most blockSize_
+ */
+void freqFilter::filter(const float* in,float* out,int n) {
+  while (n>0) {
+    const int m = min(n,blockSize_);
+    filterBlock(in,out,m);
+    in+=m;
+    out+=m;
+    n-=m;
+  }
+}
 
-  // multiply Xw_ and Hw_
-  for (int n=0;n<HwSize_;++n) {
+/*
+ * Filter n samples (n <= blockSize_).  A shorter block is placed in the
+ * history like a full one, so that the next block continues right after it.
+ */
+void freqFilter::filterBlock(const float* in,float* out,const int n) {
+  // take the last published response, if there is a new one
+  if (latest_.load(std::memory_order_relaxed) & Dirty) {
+    front_ = latest_.exchange(front_,std::memory_order_acq_rel) & SlotMask;
+  }
 
-#if 0 // def _DSP_DEBUG
-    if (n<8) {
-      std::cerr << n << "\t ("
-                << Xw_[n][0] << " + j" << Xw_[n][1] << ") x ("
-                << Hw_[n][0] << " + j" << Hw_[n][1] << ") -> (";
+  // we use overlap-save method: the last hnSize_-1 samples, then the
+  // block, and zeros up to HwSize_ >= blockSize_+hnSize_-1 >= n+hnSize_-1.
+  // The zeros replace the output of the previous block.
+  const int h = tailLength();
+  memcpy(xn_,hist_+pos_,(h-pos_)*sizeof(float));
+  memcpy(xn_+h-pos_,hist_,pos_*sizeof(float));
+  memcpy(xn_+h,in,n*sizeof(float));
+  memset(xn_+h+n,0,(HwSize_-h-n)*sizeof(float));
+
+  // the block replaces the oldest samples of the history
+  if (n>=h) {
+    memcpy(hist_,in+n-h,h*sizeof(float));
+    pos_=0;
+  } else {
+    const int first = min(n,h-pos_);
+    memcpy(hist_+pos_,in,first*sizeof(float));
+    memcpy(hist_,in+first,(n-first)*sizeof(float));
+    pos_ += n;
+    if (pos_>=h) {
+      pos_-=h;
     }
-#endif
-
-    mul(Xw_[n],Hw_[n]);
+  }
 
-#if 0 // def _DSP_DEBUG
-    if (n<8) {
-      std::cerr << Xw_[n][0] << " + j" << Xw_[n][1] << ")" << std::endl;
-    }
-#endif
+  // input to the frequency domain
+  if (smallFft_!=0) {
+    smallFft_(xn_,XwRe_,XwIm_);
+  } else {
+    fftwf_execute(fft_);
+  }
 
+  // multiply Xw_ and Hw_
+  const int offset = front_*(HwSize_/2+1);
+  if (HwReHalf_!=0) {
+    mul(HwReHalf_+offset,HwImHalf_+offset);
+  } else {
+    mul(HwRe_+offset,HwIm_+offset);
   }
 
   // return to the time domain
-  fftwf_execute(ifft_);
+  if (smallIfft_!=0) {
+    smallIfft_(XwRe_,XwIm_,yn_);
+  } else {
+    fftwf_execute(ifft_);
+  }
 
   // and the last step: move the data to the output array
-  memcpy(out,yn_+hnSize1,blockSize_*sizeof(float));
+  memcpy(out,yn_+h,n*sizeof(float));
+}
+
+int freqFilter::tailLength() const {
+  return max(hnSize_-1,0);
 }
 
 void freqFilter::reset() {
   if (HwSize_>0) {
-    memset(xn_,0,sizeof(float)*HwSize_);
-    memset(yn_,0,sizeof(float)*HwSize_);
+    memset(hist_,0,sizeof(float)*max(hnSize_-1,1));
   }
+  pos_=0;
 }
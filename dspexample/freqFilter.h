@@ -29,6 +29,9 @@
 #define FREQFILTER_H
 
 #include <fftw3.h>
+#include <cstdint>
+#include <atomic>
+#include "smallfft.h"
 
 /**
  * Filtering operation in the frequency domain.
@@ -37,7 +40,26 @@
  * defined in the frequency domain.
  *
  * It is assumed that the frequency response is hermetian, and therefore
- * represents a real valued impulse response filter.
+ * represents a real valued impulse response filter.  Only the first
+ * HwSize/2+1 bins are kept, and they are stored as separate real and
+ * imaginary arrays (split complex layout), so that the per-bin products
+ * of the filtering are plain vertical SIMD operations.
+ *
+ * Optionally, the frequency response can be stored in half precision.
+ *
+ * Both transforms run in place on the real part of the spectrum, and only
+ * the hnSize-1 input samples needed by the next block are kept.  Each
+ * block touches 2.5*HwSize+hnSize floats: the spectrum, the history and
+ * one slot of the frequency response (2*HwSize+hnSize in half precision).
+ * For the equalizer (hnSize=3/8*HwSize) this is less than half of the
+ * 6*HwSize floats of interleaved complex buffers with separate input and
+ * output arrays.
+ *
+ * The frequency response can be replaced while another thread is running
+ * filter(), as long as its size does not change: it is prepared in a spare
+ * slot and published with a single atomic exchange (triple buffering), and
+ * filter() takes it at the beginning of its next block.  Neither side ever
+ * waits for the other.
  */
 class freqFilter {
 public:
@@ -45,8 +67,11 @@ public:
    * Constructor
    *
    * @param blockSize size of the data blocks to be filtered
+   * @param halfPrecision store the frequency response in half precision,
+   *                      halving its footprint.  The arithmetic is done in
+   *                      single precision anyway.
    */
-  freqFilter(int blockSize);
+  freqFilter(int blockSize,bool halfPrecision=false);
 
   /**
    * Destructor
@@ -77,7 +102,14 @@ public:
    * Filter the input block of the size given at construction time and produce
    * the output of the same size considering past evaluations.
    */
-  void filter(float* in,float* out);
+  void filter(const float* in,float* out);
+
+  /**
+   * Filter n samples.  Larger inputs are split into blocks of the size
+   * given at construction time.  Each block costs a full transform, no
+   * matter how short it is.
+   */
+  void filter(const float* in,float* out,int n);
 
   /**
    * Reset
@@ -86,12 +118,32 @@ public:
    */
   void reset();
 
+  /**
+   * Number of samples the output keeps depending on past input, i.e. the
+   * length of the impulse response minus one
+   */
+  int tailLength() const;
+
 protected:
   /**
    * Block size
    */
   int blockSize_;
 
+  /**
+   * Frequency response stored in half precision
+   */
+  bool halfPrecision_;
+
+  /**
+   * Slots of the frequency response
+   */
+  enum {
+    Slots=3,
+    SlotMask=3,
+    Dirty=4 /**< Flag in latest_: slot not taken by filter() yet */
+  };
+
   /**
    * Frequency response size
    */
@@ -113,22 +165,93 @@ protected:
   fftwf_plan ifft_;
 
   /**
-   * Buffer used for frequency domain filter response
+   * Compile-time specialized direct transform, used instead of fft_ for
+   * small frequency response sizes (null if not available)
+   */
+  smallFFTSelector::forwardFn smallFft_;
+
+  /**
+   * Compile-time specialized inverse transform, used instead of ifft_ for
+   * small frequency response sizes (null if not available)
+   */
+  smallFFTSelector::inverseFn smallIfft_;
+
+  /**
+   * Real part of the frequency domain filter response, in Slots slots of
+   * HwSize_/2+1 bins
+   */
+  float* HwRe_;
+
+  /**
+   * Imaginary part of the frequency domain filter response
    */
-  fftwf_complex* Hw_;
+  float* HwIm_;
 
   /**
-   * Buffer used for frequency domain input
+   * @name Frequency domain filter response in half precision, used instead
+   * of HwRe_ and HwIm_ if halfPrecision_ is set
    */
-  fftwf_complex* Xw_;
+  //{
+  uint16_t* HwReHalf_;
+  uint16_t* HwImHalf_;
+  //}
 
   /**
-   * Buffer used for the input in discrete time domain
+   * Slot used by filter() (only accessed by the filtering thread)
+   */
+  int front_;
+
+  /**
+   * Slot being prepared by setFilter() (only accessed by the setting
+   * thread)
+   */
+  int back_;
+
+  /**
+   * Last published slot, plus the Dirty flag if filter() did not take it
+   * yet
+   */
+  std::atomic<int> latest_;
+
+  /**
+   * Real part of the frequency domain input
+   *
+   * It holds HwSize_ floats instead of HwSize_/2+1, since both transforms
+   * are computed in place: the input block is placed here after the
+   * history, and the inverse transform leaves the output here.
+   */
+  float* XwRe_;
+
+  /**
+   * Imaginary part of the frequency domain input
+   */
+  float* XwIm_;
+
+  /**
+   * Circular history with the last hnSize_-1 input samples, which are
+   * placed before the next block.  The oldest one is at pos_.  New samples
+   * overwrite the oldest ones, so the history is never shifted.
+   */
+  float* hist_;
+
+  /**
+   * Position of the oldest sample in hist_
+   */
+  int pos_;
+
+  /**
+   * Input of the direct transform in discrete time domain
+   *
+   * Usually this is XwRe_ (in-place direct transform).  It is only
+   * allocated separately if FFTW cannot create an in-place plan.
    */
   float* xn_;
 
   /**
    * Buffer used for the output in discrete time domain
+   *
+   * Usually this is XwRe_ (in-place inverse transform).  It is only
+   * allocated separately if FFTW cannot create an in-place plan.
    */
   float* yn_;
 
@@ -143,10 +266,36 @@ protected:
   inline int max(const int a,const int b) const;
 
   /**
-   * Multiply two complex numbers and return the result
+   * Multiply the input spectrum with the filter response, bin by bin,
+   * leaving the result in XwRe_ and XwIm_
+   */
+  template<typename S>
+  inline void mul(const S* HwRe,const S* HwIm);
+
+  /**
+   * Set the bin k of the filter response being prepared
+   */
+  inline void setBin(const int k,const float re,const float im);
+
+  /**
+   * Publish the prepared filter response
+   */
+  void publish();
+
+  /**
+   * Filter a block of n <= blockSize_ samples
+   */
+  void filterBlock(const float* in,float* out,const int n);
+
+  /**
+   * Release all buffers and plans
+   */
+  void clear();
+
+  /**
+   * Allocate buffers and create the plans for the given sizes
    */
-  inline void mul(fftwf_complex& X,
-                  const fftwf_complex& H) const;
+  void resize(int HwSize,int hnSize);
 
 };
 
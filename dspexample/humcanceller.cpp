@@ -0,0 +1,220 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   humcanceller.cpp
+ *         Adaptive cancellation of the mains hum
+ * \author Pablo Alvarado
+ * \date   2011.10.18
+ *
+ * $Id: humcanceller.cpp $
+ */
+
+#include "humcanceller.h"
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+// the mains frequency never drifts further than this
+const float humCanceller::MaxDeviation = 2.0f;
+
+namespace {
+  const double TwoPi = 6.283185307179586476925;
+
+  // loop gains of the phase locked loop, per block
+  const float PhaseGain = 0.1f;
+  const float FrequencyGain = 0.01f;
+
+  // smoothing of the phase detector output between blocks
+  const float DetectorSmoothing = 0.2f;
+
+  // below this hum amplitude the tracker keeps its frequency
+  const float LockLevel = 1.0e-4f;
+}
+
+humCanceller::humCanceller()
+  : sampleRate_(0),nominal_(0.0f),harmonics_(0),active_(0),mu_(0.0f),
+    phase_(0.0),omega_(0.0),detRe_(0.0f),detIm_(0.0f) {
+  memset(a_,0,sizeof(a_));
+  memset(b_,0,sizeof(b_));
+}
+
+/*
+ * Destructor
+ */
+humCanceller::~humCanceller() {
+}
+
+/*
+ * Init the filter operation
+ */
+void humCanceller::init(int sampleRate,
+                        float frequency,
+                        int harmonics,
+                        float stepSize) {
+  sampleRate_=sampleRate;
+  nominal_=frequency;
+
+  if (harmonics>MaxHarmonics) {
+    harmonics=MaxHarmonics;
+  }
+
+  // only harmonics well below the Nyquist frequency, even after a drift
+  active_=0;
+  while ((active_<harmonics) &&
+         ((active_+1)*(frequency+MaxDeviation) < 0.45f*sampleRate)) {
+    ++active_;
+  }
+  harmonics_=(active_+3) & ~3;
+
+  setStepSize(stepSize);
+  reset();
+}
+
+void humCanceller::setStepSize(float stepSize) {
+  mu_ = (stepSize<0.0f) ? 0.0f : (stepSize>1.0f) ? 1.0f : stepSize;
+}
+
+/*
+ * Reset the weights and the tracker
+ */
+void humCanceller::reset() {
+  memset(a_,0,sizeof(a_));
+  memset(b_,0,sizeof(b_));
+  phase_=0.0;
+  omega_=TwoPi*nominal_/sampleRate_;
+  detRe_=detIm_=0.0f;
+}
+
+float humCanceller::getFrequency() const {
+  return omega_*sampleRate_/TwoPi;
+}
+
+int humCanceller::tailLength() const {
+  return 0;
+}
+
+/**
+ * Filter the in buffer and leave the result in out
+ */
+void humCanceller::filter(int blockSize,
+                          const float* in,
+                          float* out) {
+  if (blockSize<=0) {
+    return;
+  }
+
+  // oscillator state of each harmonic: the phasor exp(j h phase) and its
+  // rotation per sample exp(j h omega).  They are computed exactly at the
+  // beginning of each block, so no error accumulates between blocks.
+  float zr[MaxHarmonics],zi[MaxHarmonics];
+  float rr[MaxHarmonics],ri[MaxHarmonics];
+  float ga[MaxHarmonics],gb[MaxHarmonics];
+  for (int h=0;h<harmonics_;++h) {
+    const double p=(h+1)*phase_;
+    const double w=(h+1)*omega_;
+    zr[h]=cos(p);
+    zi[h]=sin(p);
+    rr[h]=cos(w);
+    ri[h]=sin(w);
+    ga[h]=gb[h]=0.0f;
+  }
+
+  // phase detector: single bin DFT of the input at the fundamental
+  float pr=0.0f,pi=0.0f;
+
+  for (int n=0;n<blockSize;++n) {
+    const float x=in[n];
+    pr+=x*zr[0];
+    pi-=x*zi[0];
+
+#ifdef __SSE__
+    __m128 acc=_mm_setzero_ps();
+    for (int h=0;h<harmonics_;h+=4) {
+      const __m128 c=_mm_loadu_ps(zr+h);
+      const __m128 s=_mm_loadu_ps(zi+h);
+      acc=_mm_add_ps(acc,_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a_+h),c),
+                                    _mm_mul_ps(_mm_loadu_ps(b_+h),s)));
+    }
+    acc=_mm_add_ps(acc,_mm_movehl_ps(acc,acc));
+    acc=_mm_add_ss(acc,_mm_shuffle_ps(acc,acc,1));
+    const float e=x-_mm_cvtss_f32(acc);
+
+    const __m128 ve=_mm_set1_ps(e);
+    for (int h=0;h<harmonics_;h+=4) {
+      const __m128 c=_mm_loadu_ps(zr+h);
+      const __m128 s=_mm_loadu_ps(zi+h);
+      const __m128 cr=_mm_loadu_ps(rr+h);
+      const __m128 ci=_mm_loadu_ps(ri+h);
+      _mm_storeu_ps(ga+h,_mm_add_ps(_mm_loadu_ps(ga+h),_mm_mul_ps(ve,c)));
+      _mm_storeu_ps(gb+h,_mm_add_ps(_mm_loadu_ps(gb+h),_mm_mul_ps(ve,s)));
+      // advance the oscillator: z = z * r
+      _mm_storeu_ps(zr+h,_mm_sub_ps(_mm_mul_ps(c,cr),_mm_mul_ps(s,ci)));
+      _mm_storeu_ps(zi+h,_mm_add_ps(_mm_mul_ps(c,ci),_mm_mul_ps(s,cr)));
+    }
+#else
+    float y=0.0f;
+    for (int h=0;h<harmonics_;++h) {
+      y+=a_[h]*zr[h]+b_[h]*zi[h];
+    }
+    const float e=x-y;
+
+    for (int h=0;h<harmonics_;++h) {
+      ga[h]+=e*zr[h];
+      gb[h]+=e*zi[h];
+      const float c=zr[h];
+      zr[h]=c*rr[h]-zi[h]*ri[h];
+      zi[h]=c*ri[h]+zi[h]*rr[h];
+    }
+#endif
+
+    out[n]=e;
+  }
+
+  // block NLMS update of the weights
+  const float g=2.0f*mu_/blockSize;
+  for (int h=0;h<active_;++h) {
+    a_[h]+=g*ga[h];
+    b_[h]+=g*gb[h];
+  }
+
+  // phase locked loop: the phase detected is the one of the hum relative
+  // to the oscillator
+  const float scale=2.0f/blockSize;
+  detRe_+=DetectorSmoothing*(scale*pr-detRe_);
+  detIm_+=DetectorSmoothing*(scale*pi-detIm_);
+
+  phase_+=omega_*blockSize;
+  if ((detRe_*detRe_+detIm_*detIm_) > LockLevel*LockLevel) {
+    const float err=atan2(detIm_,detRe_);
+    phase_+=PhaseGain*err;
+    omega_+=FrequencyGain*err/blockSize;
+
+    const double dev=TwoPi*MaxDeviation/sampleRate_;
+    const double nom=TwoPi*nominal_/sampleRate_;
+    if (omega_>nom+dev) {
+      omega_=nom+dev;
+    } else if (omega_<nom-dev) {
+      omega_=nom-dev;
+    }
+  }
+  phase_=fmod(phase_,TwoPi);
+}
@@ -0,0 +1,177 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   humcanceller.h
+ *         Adaptive cancellation of the mains hum
+ * \author Pablo Alvarado
+ * \date   2011.10.18
+ *
+ * $Id: humcanceller.h $
+ */
+
+#ifndef HUMCANCELLER_H
+#define HUMCANCELLER_H
+
+/**
+ * Adaptive hum canceller
+ *
+ * Unlike the combFilter, which notches every multiple of a fixed frequency
+ * up to the Nyquist frequency, this filter removes only the first few
+ * harmonics of the mains frequency, and follows its drift.
+ *
+ * An oscillator produces, for each harmonic h, the reference pair
+ * \f$c_h(n)=\cos(h\phi(n))\f$ and \f$s_h(n)=\sin(h\phi(n))\f$.  The hum
+ * estimate and the output are
+ * \f[
+ * \hat{y}(n)=\sum_{h=1}^{N} a_h c_h(n) + b_h s_h(n) \qquad
+ * e(n)=x(n)-\hat{y}(n)
+ * \f]
+ * and the weights are adapted once per block with the normalized block LMS
+ * rule, e.g. \f$a_h \leftarrow a_h + \frac{2\mu}{B}\sum_n e(n)c_h(n)\f$.
+ * Since the references are unit sinusoids, the normalization is constant.
+ * All harmonics are processed together in SIMD registers.
+ *
+ * The oscillator is the numerically controlled oscillator of a phase locked
+ * loop.  Its phase detector is a single bin DFT (Goertzel) of the input at
+ * the current fundamental over each block, smoothed over some blocks.
+ */
+class humCanceller {
+public:
+  /**
+   * Constructor
+   */
+  humCanceller();
+
+  /**
+   * Destructor
+   */
+  ~humCanceller();
+
+  /**
+   * Init the filter operation
+   *
+   * @param sampleRate used sample rate
+   * @param frequency nominal mains frequency, in Hz
+   * @param harmonics number of harmonics to cancel (at most MaxHarmonics).
+   *                  Harmonics beyond 90% of the Nyquist frequency are
+   *                  ignored.
+   * @param stepSize adaptation step size mu, between 0 and 1
+   */
+  void init(int sampleRate,
+            float frequency=60.0f,
+            int harmonics=8,
+            float stepSize=0.05f);
+
+  /**
+   * Filter the in buffer and leave the result in out
+   */
+  void filter(int blockSize,
+              const float* in,
+              float* out);
+
+  /**
+   * Set the adaptation step size mu, between 0 and 1
+   */
+  void setStepSize(float stepSize);
+
+  /**
+   * Currently tracked mains frequency, in Hz
+   */
+  float getFrequency() const;
+
+  /**
+   * Reset the weights and the tracker
+   */
+  void reset();
+
+  /**
+   * Number of samples the output keeps depending on past input.
+   *
+   * The hum estimate does not decay, but the stage must not emit it while
+   * its input is silent, so that it can be skipped at once.
+   */
+  int tailLength() const;
+
+  /**
+   * Largest deviation of the tracked frequency from the nominal one, in Hz
+   */
+  static const float MaxDeviation;
+
+  /**
+   * Some constants
+   */
+  enum {
+    MaxHarmonics=16
+  };
+
+protected:
+  /**
+   * Sample rate
+   */
+  int sampleRate_;
+
+  /**
+   * Nominal frequency, in Hz
+   */
+  float nominal_;
+
+  /**
+   * Number of harmonics in use, rounded up to a multiple of 4.  The extra
+   * ones have zero weights and are never adapted.
+   */
+  int harmonics_;
+
+  /**
+   * Number of harmonics actually adapted
+   */
+  int active_;
+
+  /**
+   * Adaptation step size
+   */
+  float mu_;
+
+  /**
+   * @name Weights of the cosine and sine references of each harmonic
+   */
+  //{
+  float a_[MaxHarmonics];
+  float b_[MaxHarmonics];
+  //}
+
+  /**
+   * Phase of the oscillator at the beginning of the next block, in rad
+   */
+  double phase_;
+
+  /**
+   * Frequency of the oscillator, in rad per sample
+   */
+  double omega_;
+
+  /**
+   * @name Smoothed phase detector output (complex)
+   */
+  //{
+  float detRe_;
+  float detIm_;
+  //}
+};
+
+#endif // HUMCANCELLER_H
@@ -26,17 +26,17 @@
  */
 
 #include "jack.h"
+#include "simd.h"
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cmath>
 
 #include <iostream>
 
 #include <unistd.h>
 
-#include <QMessageBox>
-
 #undef _DSP_DEBUG
 #define _DSP_DEBUG
 
@@ -50,7 +50,7 @@
 /**
  * Constructor
  */
-jack::fileThread::fileThread() : playing_(false), exitRq_(false)
+jack::fileThread::fileThread() : exitRq_(false)
 {
 
 }
@@ -63,16 +63,6 @@ jack::fileThread::~fileThread()
   exitRq_=true;
 }
 
-void jack::fileThread::suspend()
-{
-  playing_ = false;
-}
-
-void jack::fileThread::resume()
-{
-  playing_ = true;
-}
-
 void jack::fileThread::exitRequest()
 {
   exitRq_ = true;
@@ -89,41 +79,35 @@ void jack::fileThread::run()
 
   _debug("fileThread::run() called\n");
 
+  simd::disableDenormals();
+
   while(!exitRq_)
   {
-
-    if (playing_)
+    for (int v=0;v<mixer::MaxVoices;++v)
     {
-      if ((jack::fileWindow_-jack::playWindow_+1)<jack::MaxWindows)
-      {
-        //_debug(".");
-        playing_ = (jack::getNextBlock() > 0);
-      }
+      jack::serve(v);
     }
+
     usleep(jack::sleepTime_);
-    jack::cleanGarbage();
+    jack::garbage_.collect();
   }
 
+  for (int v=0;v<mixer::MaxVoices;++v)
+  {
+    jack::closeStreams(v);
+  }
 }
 
 /*
  * Garbage
  *
- * This map holds all pointers to memory that needs removal.
- * The memory is not removed inmediately since the highly multithreading
- * architecture makes it difficult to safetly remove it, without implementing
- * a mutex/semaphore control, which is not advisable because it is too slow
- * for the process() method of jack.  We just ensure that for several block
- * reads and processes the memory is still there, but later on it is auto-
- * matically removed by the secondary thread.
+ * Old buffers cannot be removed inmediately, since the process() callback
+ * may still be reading them, and it cannot wait for a mutex.  They are
+ * retired here instead, and the secondary thread frees them once the
+ * process() callback started a new block after their replacement.
  */
-jack::garbage_type jack::garbage_;
-
+reclaimer jack::garbage_;
 
-/*
- * Size of the window being played
- */
-int jack::windowSize_ = 0;
 
 /*
  * Sample rate used
@@ -156,55 +140,42 @@ jack_client_t* jack::client_=0;
 processor* jack::dsp_=0;
 
 fileManager* jack::fd_=0;
-/*
- * Handler to file being played
- */
-SNDFILE* jack::file_=0;
 
 /*
- * Playing file
+ * Voices playing files
  */
-bool jack::playingFile_=false;
-
-/*
- * List of files to be played
- */
-std::list<std::string> jack::audioFiles_;
-
-/*
- * Mutex to protect the audioFiles_ list from multiple access
- */
-QMutex jack::lock_;
+jack::voice jack::voices_[mixer::MaxVoices];
 
 /*
- * Window block
+ * Mixer of the live input and the voices
  */
-int jack::fileWindow_=0;
+mixer jack::mixer_;
 
 /*
- * Window block
+ * Errors to be shown by the GUI thread
  */
-int jack::playWindow_=0;
+QStringList jack::errors_;
 
 /*
- * Buffer with fusioned and sample-rate-fixed buffer
+ * Mutex to protect the file lists, the stop requests and errors_ from
+ * multiple access
  */
-float* jack::audioBuffer_=0;
+QMutex jack::lock_;
 
 /*
- * Buffer with fusioned and sample-rate-fixed buffer
+ * Default read-ahead, in seconds
  */
-int jack::audioBufferSize_=0;
+const float jack::ReadAhead = 2.0f;
 
 /*
- * Buffer with fusioned and sample-rate-fixed buffer
+ * Read-ahead in use, in seconds
  */
-float* jack::fileBuffer_ = 0;
+float jack::readAhead_ = jack::ReadAhead;
 
 /*
- * Buffer with fusioned and sample-rate-fixed buffer
+ * Buffer used to decode before copying to the ring
  */
-int jack::fileBufferSize_ = 0;
+float* jack::decodeBuffer_=0;
 
 /*
  * Create the thread
@@ -212,17 +183,7 @@ int jack::fileBufferSize_ = 0;
 jack::fileThread jack::thread_;
 
 /*
- * Sample rate of the file being played
- */
-int jack::fileSampleRate_=0;
-
-/*
- * Number of channels in the file
- */
-int jack::fileChannels_=0;
-
-/*
- * Time waited between windows checks
+ * Time waited between checks of the ring
  */
 int jack::sleepTime_=0;
 
@@ -251,14 +212,9 @@ void jack::close()
   }
 
   _debug(" Waiting threads to stop...");
-  usleep(2*sleepTime_);
+  thread_.wait();
   _debug(" done." << std::endl);
 
-  _debug(" Clean garbage" << std::endl);
-  while(!garbage_.empty()) {
-    cleanGarbage();
-  }
-
   if (client_!=NULL)
   {
     _debug(" Stop JACK client" << std::endl);
@@ -267,14 +223,18 @@ void jack::close()
   }
   dsp_=0;
 
+  // the process() callback is not running anymore
+  _debug(" Clean garbage" << std::endl);
+  garbage_.collectAll();
+
   _debug(" Clean up remaining buffers" << std::endl);
-  delete[] audioBuffer_;
-  audioBuffer_=0;
-  audioBufferSize_=0;
+  for (int v=0;v<mixer::MaxVoices;++v)
+  {
+    delete mixer_.exchange(v,0);
+  }
 
-  delete[] fileBuffer_;
-  fileBuffer_=0;
-  fileBufferSize_=0;
+  delete[] decodeBuffer_;
+  decodeBuffer_=0;
 }
 
 void jack::init(fileManager* datoLeido, processor* proc)
@@ -324,6 +284,13 @@ void jack::init(fileManager* datoLeido, processor* proc)
     std::cerr << "Unable to set process callback" << std::endl;
   };
 
+  /* the processing stages have to run without subnormal floats
+   */
+  if (jack_set_thread_init_callback(client_,jack::threadInit,dsp_) != 0)
+  {
+    std::cerr << "Unable to set thread init callback" << std::endl;
+  }
+
   /* tell the JACK server to call `shutdown()' if
    * it ever shuts down, either entirely, or if it
    * just decides to stop calling us.
@@ -460,21 +427,23 @@ int jack::process(jack_nframes_t nframes, void *arg) {
   _debug(prog[progIdx] << "\r");
 #endif
 
+  // nothing taken in previous blocks is used after this point
+  garbage_.quiescent();
+
   jack_default_audio_sample_t *in, *out;
 
-  if (playingFile_)
-  {
-    in = audioBuffer_+bufferSize_*(playWindow_%MaxWindows);
-    ++playWindow_;
-  }
-  else
-  {
-    in  = static_cast<jack_default_audio_sample_t*>
-          (jack_port_get_buffer(inputPort_, nframes));
-  }
   out = static_cast<jack_default_audio_sample_t*>
         (jack_port_get_buffer(outputPort_,nframes));
 
+  in  = static_cast<jack_default_audio_sample_t*>
+        (jack_port_get_buffer(inputPort_, nframes));
+
+  // the live input and the voices playing files are mixed into the output
+  // buffer, which is then processed in place.  The file samples are taken
+  // from memory only.
+  mixer_.mix(in,out,nframes);
+  in = out;
+
   // return 0 on success, or anything else on error
   processor* dsp = reinterpret_cast<processor*>(arg);
 
@@ -482,7 +451,7 @@ int jack::process(jack_nframes_t nframes, void *arg) {
   //fd_->writeln(nframes, out);
 
   //A continuación se llama a process() definida dentro de dspsystem.cpp
-  return (dsp->process(in,out))?0:1;
+  return (dsp->process(in,out,nframes))?0:1;
 }
 
 /*
@@ -507,6 +476,13 @@ int jack::sampleRateChanged(jack_nframes_t nframes, void *arg) {
   return ptr->setSampleRate(nframes);
 }
 
+/*
+ * Callback executed at the start of the JACK process thread
+ */
+void jack::threadInit(void *) {
+  simd::disableDenormals();
+}
+
 /*
  * Callback used to update used buffer size
  */
@@ -519,18 +495,27 @@ int jack::bufferSizeChanged(jack_nframes_t nframes, void *arg) {
  * Stop playing from files (the capture will continue from the mic
  */
 bool jack::stopFiles() {
+  for (int v=0;v<mixer::MaxVoices;++v) {
+    stopVoice(v);
+  }
+  return true;
+}
+
+/*
+ * Stop playing from files in one voice
+ */
+bool jack::stopVoice(int v) {
+  if ((v<0) || (v>=mixer::MaxVoices)) {
+    return false;
+  }
+
   lock_.lock();
-  thread_.suspend();
-  playingFile_=false;
+  mixer_.setActive(v,false);
 
-  audioFiles_.clear();
+  voices_[v].files.clear();
 
-  // close any other previous open file
-  if (file_ != 0) {
-    int err;
-    err=sf_close(file_);
-    file_=0;
-  }
+  // the file thread closes the streams
+  voices_[v].stopRq=true;
 
   lock_.unlock();
 
@@ -538,23 +523,45 @@ bool jack::stopFiles() {
 }
 
 /*
- * Start playing the given file
+ * Start playing the given file after the ones already given to the voice
  */
-bool jack::playAlso(const char* filename)
+bool jack::playAlso(const char* filename,int v)
 {
-  lock_.lock();
-  if (!playingFile_)
+  if ((v<0) || (v>=mixer::MaxVoices))
   {
-    play(filename);
+    return false;
   }
-  else
+
+  if (!thread_.isRunning())
   {
-    audioFiles_.push_back(filename);
+    thread_.start();
   }
+
+  lock_.lock();
+  voices_[v].files.push_back(filename);
   lock_.unlock();
   return true;
 }
 
+/*
+ * Gain of a voice in the mix
+ */
+void jack::setGain(int v,float gain)
+{
+  if ((v>=0) && (v<mixer::MaxVoices))
+  {
+    mixer_.setGain(v,gain);
+  }
+}
+
+/*
+ * Gain of the live input in the mix
+ */
+void jack::setInputGain(float gain)
+{
+  mixer_.setInputGain(gain);
+}
+
 /*
  * Start playing the given file
  */
@@ -562,177 +569,262 @@ bool jack::play(const char* filename)
 {
   _debug("\njack::play(" << filename << ")\n");
 
-  if (!thread_.isRunning())
+  stopFiles();
+  return playAlso(filename);
+}
+
+/*
+ * Take the oldest error
+ */
+bool jack::popError(QString& msg)
+{
+  lock_.lock();
+  const bool found=!errors_.isEmpty();
+  if (found)
   {
-    thread_.start();
+    msg=errors_.takeFirst();
   }
+  lock_.unlock();
+  return found;
+}
 
-  thread_.suspend();
-  playingFile_=false;
+/*
+ * Report an error to the GUI thread, which polls them with popError()
+ */
+void jack::reportError(const std::string& msg)
+{
+  std::cerr << msg << std::endl;
 
-  // close any other previous open file
-  if (file_ != 0)
-  {
-    int err;
-    err=sf_close(file_);
-    file_=0;
+  lock_.lock();
+  errors_.append(QString::fromLocal8Bit(msg.c_str()));
+  lock_.unlock();
+}
 
-    if (err != 0)
-    { // not zero if error
-      QString msg = QString("Error closing file: ") + sf_error_number(err);
-      QMessageBox::StandardButton button;
-      button = QMessageBox::warning(0,"Error",msg);
-      return false;
+/*
+ * Open the next file to be played by a voice
+ */
+audioStream* jack::openNext(int v)
+{
+  std::list<std::string>& files=voices_[v].files;
+  std::string error;
+  for (;;)
+  {
+    // while a stop request is pending, the files in the list were given
+    // after it, and must not be opened before serve() discards the streams
+    // the request refers to
+    lock_.lock();
+    if (voices_[v].stopRq || files.empty())
+    {
+      lock_.unlock();
+      return 0;
     }
-  }
+    const std::string filename=files.front();
+    files.pop_front();
+    lock_.unlock();
 
-  // try to open the file
-  SF_INFO info;
-  info.format = 0; // this has to be set to zero before calling sf_open
-  file_ = sf_open(filename,SFM_READ,&info);
+    // the file is opened, probed and its first chunk decoded without
+    // holding the lock
+    audioStream* stream=new audioStream;
+    if (stream->open(filename.c_str(),sampleRate_,error,ringCapacity()))
+    {
+      _debug(" Opened " << filename << std::endl);
+      _debug(" Jack sample rate: " << sampleRate_ << std::endl);
+      _debug(" File sample rate: " << stream->fileSampleRate() << std::endl);
+      _debug(" File channels   : " << stream->channels() << std::endl);
+      return stream;
+    }
 
-  if (file_ == 0)
-  { // not zero if error
-    QString msg = QString("Error opening file: ") + filename;
-    QMessageBox::StandardButton button;
-    button = QMessageBox::warning(0,"Error",msg);
-    return false;
+    delete stream;
+    reportError(error);
   }
+}
 
-  fileSampleRate_=info.samplerate;
-  fileChannels_=info.channels;
+/*
+ * Set the read-ahead of the next files
+ */
+void jack::setReadAhead(float seconds)
+{
+  readAhead_=seconds;
+}
 
-  _debug(" Jack sample rate: " << sampleRate_ << std::endl);
-  _debug(" File sample rate: " << fileSampleRate_ << std::endl);
-  _debug(" File channels   : " << fileChannels_ << std::endl);
+/*
+ * Set the budget of the decoded audio cache
+ */
+void jack::setCacheSize(int megabytes)
+{
+  audioCache::instance().setBudget(static_cast<long long>(megabytes)<<20);
+}
 
+/*
+ * Stop, start or continue the playback of a voice
+ */
+void jack::serve(int v)
+{
+  voice& vc=voices_[v];
 
-  int newAudioBufferSize_=MaxWindows*bufferSize_;
-  if (audioBufferSize_ < newAudioBufferSize_) {
-    garbage_.push_back(std::make_pair(MaxWindows+1,audioBuffer_));
+  // a stop request discards the streams being played or prepared
+  lock_.lock();
+  const bool stop=vc.stopRq;
+  vc.stopRq=false;
+  lock_.unlock();
 
-    audioBufferSize_=newAudioBufferSize_;
-    audioBuffer_ = new float[audioBufferSize_];
-    memset(audioBuffer_,0,audioBufferSize_*sizeof(float));
+  if (stop)
+  {
+    closeStreams(v);
   }
 
-  // do we need to change the size of the buffer?
-  windowSize_ = static_cast<int>(ceil(bufferSize_*double(fileSampleRate_)/
-                                      sampleRate_));
-  int newFileBufferSize = MaxWindows*fileChannels_*windowSize_;
+  sampleRing* ring=mixer_.source(v);
+  if (vc.current==0)
+  {
+    if (mixer_.active(v) && (ring!=0) && (ring->available()>0))
+    {
+      // the end of the playlist is still being played
+    }
+    else
+    {
+      mixer_.setActive(v,false);
+      vc.current=openNext(v);
+      if (vc.current!=0)
+      {
+        startStream(v);
+      }
+    }
+  }
+  else
+  {
+    refill(v,ring);
+  }
+}
 
-  if (fileBufferSize_ < newFileBufferSize)
+/*
+ * Size of the ring of a new stream
+ */
+int jack::ringCapacity()
+{
+  int capacity=static_cast<int>(readAhead_*sampleRate_);
+  if (capacity<MinReadAhead*bufferSize_)
   {
-    garbage_.push_back(std::make_pair(MaxWindows+1,fileBuffer_));
+    capacity=MinReadAhead*bufferSize_;
+  }
+  return capacity;
+}
 
-    fileBufferSize_=newFileBufferSize;
-    fileBuffer_=new float[fileBufferSize_];
-    memset(fileBuffer_,0,fileBufferSize_*sizeof(float));
+/*
+ * Start playing the current stream of a voice.  The voice is not active,
+ * so the process() callback does not read its ring.
+ */
+void jack::startStream(int v)
+{
+  if (decodeBuffer_==0)
+  {
+    decodeBuffer_=new float[audioStream::ChunkFrames];
   }
 
-  fileWindow_=0;
-  playWindow_=0;
+  // a new ring, since the process() callback may still be reading the old
+  // one
+  sampleRing* ring=new sampleRing(ringCapacity());
 
-  thread_.resume();
-  playingFile_=true;
+  _debug(" Read-ahead of " << ring->capacity() << " samples" << std::endl);
 
-  return true;
-}
+  // playing starts as soon as the first chunk is there
+  const int cnt=decode(v,decodeBuffer_,audioStream::ChunkFrames);
+  ring->write(decodeBuffer_,cnt);
 
-int jack::getNextBlock()
-{
-  sf_count_t cnt = 0;
+  garbage_.retire(mixer_.exchange(v,ring));
 
-  if (playingFile_ && (file_ != 0))
+  if (cnt==0)
   {
-    int wndIndex = fileWindow_%MaxWindows;
+    return;
+  }
 
-    float* mem = fileBuffer_+ windowSize_*fileChannels_*wndIndex;
+  lock_.lock();
+  if (!voices_[v].stopRq)
+  {
+    mixer_.setActive(v,true);
+  }
+  lock_.unlock();
+}
 
-    // this reads the buffer from the file
-    cnt = sf_readf_float(file_,mem,windowSize_);
-    fd_->writeln(windowSize_, mem);
-    const int last = (cnt*bufferSize_)/windowSize_;
+/*
+ * Top up the ring of a voice if it fell below the low watermark
+ */
+void jack::refill(int v,sampleRing* ring)
+{
+  if (ring->available() >= ring->capacity()/LowWatermark)
+  {
+    return;
+  }
 
-    // now let's interpolate the right samplerate
-    float* wnd=audioBuffer_+wndIndex*bufferSize_;
-    int i;
-    for (i=0;i<last;++i)
+  // fill it up in large chunks, so that the disk is seldom touched
+  while (voices_[v].current!=0)
+  {
+    int frames = ring->space();
+    if (frames<=0)
     {
-      // we also need to compute the average of all channels.
-      int j=(i*fileSampleRate_/sampleRate_)*fileChannels_;
-      const int ej=j+fileChannels_;
-      float acc=mem[j];
-      for (++j;j<ej;++j)
-      {
-        acc+=mem[j];
-      }
-      wnd[i]=acc/fileChannels_;
+      break;
     }
-    // fill the rest with 0s
-    for (;i<bufferSize_;++i)
+    if (frames>audioStream::ChunkFrames)
     {
-      wnd[i]=0.0f;
+      frames=audioStream::ChunkFrames;
     }
-    ++fileWindow_;
+    const int cnt=decode(v,decodeBuffer_,frames);
+    ring->write(decodeBuffer_,cnt);
   }
+}
 
-  // should we proceed with the next audio file?
-  if (playingFile_ && (cnt==0))
-  { // cnt==0 means the last file stopped playing
-    _debug("jack.cpp(nextBlock) End of file." << std::endl);
-
-    cnt=1; // the cnt flag has to be different than zero to keep playing!
-    lock_.lock();
-    std::string next;
-    do
-    {
-      if (audioFiles_.empty())
-      {
-        // no more files given.  Stop playing them
-        thread_.suspend();
-        playingFile_=false;
-
-        _debug("(jack.cpp nextBlock)No more files to play." << std::endl);
-
-        if (file_ != 0)
-        {
-          int err;
-          err=sf_close(file_);
-          file_=0;
-        }
-        cnt=0; // do not play any further
+/*
+ * Close the streams of a voice
+ */
+void jack::closeStreams(int v)
+{
+  delete voices_[v].current;
+  voices_[v].current=0;
+  delete voices_[v].next;
+  voices_[v].next=0;
+}
 
-        break;
-      }
+/*
+ * Decode the next frames from the streams of a voice
+ */
+int jack::decode(int v,float* out,int frames)
+{
+  voice& vc=voices_[v];
 
-      next = audioFiles_.front();
-      audioFiles_.pop_front();
+  // when a stream ends, the block is completed with the next one, which
+  // was already opened and partially decoded: there is no gap between them
+  int cnt=0;
+  while ((cnt<frames) && (vc.current!=0))
+  {
+    cnt+=vc.current->read(out+cnt,frames-cnt);
+    if (cnt<frames)
+    {
+      _debug("jack.cpp(decode) End of file " << vc.current->name()
+             << std::endl);
+      delete vc.current;
+      vc.current = (vc.next!=0) ? vc.next : openNext(v);
+      vc.next=0;
     }
-    while(!play(next.c_str()));
-
-    lock_.unlock();
   }
-  return static_cast<int>(cnt);
-}
 
-void jack::cleanGarbage()
-{
-  // clean the garbage
-  garbage_type::iterator it=jack::garbage_.begin();
-  while(it!=jack::garbage_.end())
+  // only the values of the first voice are dumped.  Since the streams
+  // decode on their own, these are the mono samples already converted to
+  // the JACK sample rate, and no longer the raw interleaved frames read
+  // from the file.
+  if (v==0)
   {
-    if ( (--(it->first)) <= 0)
-    {
-      _debug("Cleaning garbage" << std::endl);
+    fd_->writeln(cnt, out);
+  }
 
-      delete[] it->second;
-      it = garbage_.erase(it);
+  // prepare the next file while this one is being played
+  if ((vc.current!=0) && (vc.next==0))
+  {
+    vc.next=openNext(v);
+  }
 
-    }
-    else
-    {
-      ++it;
-    }
+  if (vc.current==0)
+  {
+    _debug("(jack.cpp decode)No more files to play." << std::endl);
   }
+
+  return cnt;
 }
@@ -29,16 +29,22 @@
 #define JACK_H
 
 #include <jack/jack.h>
-#include <sndfile.h>
 
 #include <list>
-#include <utility> // for std::pair
+#include <string>
+#include <atomic>
 
 #include <QThread>
 #include <QMutex>
+#include <QString>
+#include <QStringList>
 
 #include "processor.h"
 #include "fileManager.h"
+#include "reclaimer.h"
+#include "audiostream.h"
+#include "samplering.h"
+#include "mixer.h"
 
 class jack
 {
@@ -60,20 +66,65 @@ public:
                      jack_default_audio_sample_t* out);
 
   /**
-   * Start playing the given file, stopping everything else
+   * Start playing the given file with the first voice, stopping everything
+   * else
    */
   static bool play(const char* filename);
 
   /**
-   * Insert the given filename into the list of files to play
+   * Insert the given filename into the list of files to play by the given
+   * voice.  The voices play at the same time, mixed with the live input.
+   *
+   * @return false if the voice does not exist
    */
-  static bool playAlso(const char* filename);
+  static bool playAlso(const char* filename,int voice=0);
 
   /**
-   * Stop playing from files (the capture will continue from the mic
+   * Stop playing from files in all voices (the capture from the mic
+   * continues)
    */
   static bool stopFiles();
 
+  /**
+   * Stop playing from files in the given voice
+   */
+  static bool stopVoice(int voice);
+
+  /**
+   * Set the gain of the given voice in the mix
+   */
+  static void setGain(int voice,float gain);
+
+  /**
+   * Set the gain of the live input in the mix
+   */
+  static void setInputGain(float gain);
+
+  /**
+   * Take the oldest error found while playing files, to be shown by the
+   * GUI thread.
+   *
+   * @return false if there are no errors
+   */
+  static bool popError(QString& msg);
+
+  /**
+   * Set the amount of decoded audio kept ahead of the playback, in seconds.
+   * It is used from the next file played on.
+   */
+  static void setReadAhead(float seconds);
+
+  /**
+   * Set the memory used to keep decoded files for repeated playback, in
+   * megabytes.  Zero disables the cache.
+   */
+  static void setCacheSize(int megabytes);
+
+  /**
+   * Default amount of decoded audio kept ahead of the playback, in seconds
+   */
+  static const float ReadAhead;
+
 private:
   /**
    * Only construct privately, since this class is a singleton
@@ -105,6 +156,11 @@ private:
    */
   static int bufferSizeChanged(jack_nframes_t nframes, void *arg);
 
+  /**
+   * Callback executed at the start of the JACK process thread
+   */
+  static void threadInit(void *arg);
+
   /**
    * Sample rate used by jack (reproduction and mic capture)
    */
@@ -158,27 +214,12 @@ private:
       */
      virtual void run();
 
-     /**
-      * Suspend the file reading thread
-      */
-     void suspend();
-
-     /**
-      * Suspend the file reading thread
-      */
-     void resume();
-
      /**
       * Request the end of this thread
       */
      void exitRequest();
 
    protected:
-     /**
-      * Flag to indicate that a file is being played
-      */
-     bool playing_;
-
      /**
       * Request finilization of main loop
       */
@@ -193,55 +234,68 @@ private:
   static processor* dsp_;
 
   static fileManager* fd_;
-  /**
-   * Handler to file being played
-   */
-  static SNDFILE* file_;
 
   /**
-   * Flag to indicate that the file can be played
+   * Files played by one voice of the mixer, one after the other without
+   * gaps
    */
-  static bool playingFile_;
-
-  /**
-   * List of files to be played
-   */
-  static std::list<std::string> audioFiles_;
-
-  /**
-   * Mutex to protect the audioFiles_ list from multiple access
-   */
-  static QMutex lock_;
+  struct voice {
+    voice() : stopRq(false),current(0),next(0) {}
+
+    /**
+     * List of files to be played, protected by lock_
+     */
+    std::list<std::string> files;
+
+    /**
+     * Request to stop playing the streams, protected by lock_
+     */
+    bool stopRq;
+
+    /**
+     * Stream being played (only accessed by the file thread)
+     */
+    audioStream* current;
+
+    /**
+     * Stream prepared to continue when current ends (only accessed by the
+     * file thread)
+     */
+    audioStream* next;
+  };
 
   /**
-   * Window being read
+   * The voices
    */
-  static int fileWindow_;
+  static voice voices_[mixer::MaxVoices];
 
   /**
-   * Window being played
+   * Source stage mixing the live input with the voices.  It holds the
+   * decoded audio ready to be played by each voice, already downmixed and
+   * at the sample rate of jack, in rings created for each playlist.
    */
-  static int playWindow_;
+  static mixer mixer_;
 
   /**
-   * Buffer with fusioned and sample-rate-fixed buffer
+   * Errors to be shown by the GUI thread, protected by lock_
    */
-   static float* audioBuffer_;
+  static QStringList errors_;
 
   /**
-   * Size of buffer with fusioned and sample-rate-fixed buffer
+   * Mutex to protect the file lists and stop requests of the voices, and
+   * errors_, from multiple access
    */
-   static int audioBufferSize_;
+  static QMutex lock_;
 
   /**
-   * Buffer with file data as-is, without any normalization
+   * Size of the rings of the voices, in seconds
    */
-   static float* fileBuffer_;
+  static float readAhead_;
 
   /**
-   * Size of buffer with file data as-is, without any normalization
+   * Buffer used by the file thread to decode before copying to the ring
    */
-   static int fileBufferSize_;
+  static float* decodeBuffer_;
 
   /**
    * The file reading thread
@@ -249,56 +303,67 @@ private:
    static fileThread thread_;
 
    /**
-    * Sample rate given in the file
+    * Time waited between checks of the ring
     */
-   static int fileSampleRate_;
+   static int sleepTime_;
 
    /**
-    * Number of channels in the file
+    * Garbage
+    *
+    * Buffers replaced while the process() callback may still be reading
+    * them.  They are freed by the file thread once process() has started a
+    * new block after their replacement.
     */
-   static int fileChannels_;
+   static reclaimer garbage_;
 
    /**
-    * File window size in frames (can be different than buffer size if
-    * the sample-rate in the file is different than the one of jack)
+    * Stop, start or continue the playback of the given voice (file thread
+    * only)
     */
-   static int windowSize_;
+   static void serve(int v);
 
    /**
-    * Time waited between windows checks
+    * Decode the given number of frames from the streams of voice v,
+    * continuing with the next stream when one ends.
+    *
+    * Returns how many frames were decoded.  Less than requested means the
+    * end of the playlist.
     */
-   static int sleepTime_;
+   static int decode(int v,float* out,int frames);
 
    /**
-    * Type to keep record of old buffers still to be removed.
+    * Top up the ring of voice v if it fell below the low watermark
     */
-   typedef std::list< std::pair<int,float*> > garbage_type;
+   static void refill(int v,sampleRing* ring);
 
    /**
-    * Garbage
+    * Open the next file in the list of voice v.  Files that cannot be
+    * opened are reported and skipped.
     *
-    * This map holds all pointers to memory that needs removal.
-    * The memory is not removed inmediately since the highly multithreading
-    * architecture makes it difficult to safetly remove it, without implementing
-    * a mutex/semaphore control, which is not advisable because it is too slow
-    * and may block the process() method of jack.
-    * We just ensure that for several block reads and processes the memory is
-    * still there, but later on it is automatically removed by the secondary
-    * thread.
+    * Returns 0 if there are no more files, or if a stop request of the
+    * voice is pending
     */
-   static garbage_type garbage_;
+   static audioStream* openNext(int v);
 
    /**
-    * Clean garbage
+    * Start playing the current stream of voice v with a new ring
     */
-   static void cleanGarbage();
+   static void startStream(int v);
 
    /**
-    * Read next window in file and adapt it to the proper format.
-    *
-    * Returns how many frames were read
+    * Size of the ring of a new stream, in samples
+    */
+   static int ringCapacity();
+
+   /**
+    * Close the streams of voice v (file thread only)
+    */
+   static void closeStreams(int v);
+
+   /**
+    * Report an error to the GUI thread
     */
-   static int getNextBlock();
+   static void reportError(const std::string& msg);
 
 
    /**
@@ -306,7 +371,8 @@ private:
     */
    enum
    {
-     MaxWindows=4
+     LowWatermark=2, /**< refill below 1/LowWatermark of the ring */
+     MinReadAhead=4  /**< ring size in blocks, at least */
    };
   //}
 };
@@ -65,6 +65,13 @@ MainWindow::MainWindow(QWidget *parent) :
   timer_->start(250);
 
   dsp_ = new dspSystem;
+
+  // storage options have to be known before the processor is initialized
+  if (QCoreApplication::arguments().contains("--fp16"))
+  {
+    dsp_->setHalfPrecision(true);
+  }
+
   fd_ = new fileManager;
   jack::init(fd_,dsp_);
 
@@ -73,6 +80,7 @@ MainWindow::MainWindow(QWidget *parent) :
   // parse some command line arguments
   QStringList argv(QCoreApplication::arguments());
 
+  int voice=1; // the first voice plays the selected files
   QStringList::const_iterator it(argv.begin());
   while(it!=argv.end())
   {
@@ -80,6 +88,57 @@ MainWindow::MainWindow(QWidget *parent) :
     {
       verbose_=true;
     }
+    else if ((*it)=="--schroeder")
+    {
+      dsp_->setReverbType(dspSystem::SchroederReverb);
+      updateReverb();
+    }
+    else if ((*it)=="--fdn")
+    {
+      dsp_->setReverbType(dspSystem::FDNReverb);
+      updateReverb();
+    }
+    else if ((*it)=="--adaptive-hum")
+    {
+      dsp_->setFilter60Type(dspSystem::AdaptiveFilter60);
+    }
+    else if ((*it)=="--early")
+    {
+      dsp_->setMultiTap(true);
+    }
+    else if ((*it).startsWith("--read-ahead="))
+    {
+      // seconds of decoded audio kept ahead while playing files
+      jack::setReadAhead((*it).mid(13).toFloat());
+    }
+    else if ((*it).startsWith("--cache="))
+    {
+      // megabytes of decoded files kept for repeated playback
+      jack::setCacheSize((*it).mid(8).toInt());
+    }
+    else if ((*it).startsWith("--automation="))
+    {
+      // parameter changes at given times from now on
+      std::string tmp(qPrintable((*it).mid(13)));
+      if (dsp_->loadAutomation(tmp.c_str())<0)
+      {
+        std::cerr << "Cannot read automation file " << tmp << std::endl;
+      }
+    }
+    else if ((*it).startsWith("--input-gain="))
+    {
+      // gain of the microphone in the mix with the files
+      jack::setInputGain((*it).mid(13).toFloat());
+    }
+    else if ((*it).startsWith("--mix="))
+    {
+      // a file played by a voice of its own, on top of everything else
+      std::string tmp(qPrintable((*it).mid(6)));
+      if (!jack::playAlso(tmp.c_str(),voice++))
+      {
+        std::cerr << "No voice left for " << tmp << std::endl;
+      }
+    }
     else if ((*it).indexOf(".wav",0,Qt::CaseInsensitive)>0)
     {
       ui->fileEdit->setText(*it);
@@ -108,6 +167,23 @@ void MainWindow::update()
 
     eqChanged_=false;
   }
+
+  // report the stages that produced non-finite samples
+  dspSystem::sanitizerEvent event;
+  while (dsp_->popEvent(event))
+  {
+    QString msg = QString("%1 non-finite samples after the %2, stage reset")
+      .arg(event.samples).arg(dspSystem::stageName(event.stage));
+    std::cerr << qPrintable(msg) << std::endl;
+    ui->statusBar->showMessage(msg,5000);
+  }
+
+  // report the files that could not be played
+  QString error;
+  while (jack::popError(error))
+  {
+    ui->statusBar->showMessage(error,5000);
+  }
 }
 
 
@@ -154,10 +230,8 @@ void MainWindow::updateEqualizer() {
 
 void MainWindow::updateReverb() {
   if (dsp_!=0) {
-    reverb& rv = *(dsp_->getReverberator());
-
-    ui->alphaSpinBox->setValue(rv.getAlpha());
-    ui->delaySlider->setValue(static_cast<int>(rv.getDelay()+0.5f));
+    ui->alphaSpinBox->setValue(dsp_->getReverbAlpha());
+    ui->delaySlider->setValue(static_cast<int>(dsp_->getReverbDelay()+0.5f));
   }
 }
 
@@ -240,7 +314,7 @@ void MainWindow::on_freq16Slider_valueChanged(int value) {
 
 void MainWindow::on_alphaSpinBox_valueChanged(double value) {
   ui->dialAlpha->setValue(static_cast<int>(value*1000.0+0.5));
-  dsp_->getReverberator()->setAlpha(static_cast<float>(value));
+  dsp_->setReverbAlpha(static_cast<float>(value));
 }
 
 void MainWindow::on_dialAlpha_dialMoved(int value) {
@@ -318,9 +392,9 @@ void MainWindow::on_presetsBox_currentIndexChanged(int index) {
 }
 
 void MainWindow::on_resetButton_clicked(){
-  dsp_->getReverberator()->reset();
+  dsp_->resetReverb();
 }
 
 void MainWindow::on_delaySlider_valueChanged(int value){
-  dsp_->getReverberator()->setDelay(float(value));
+  dsp_->setReverbDelay(float(value));
 }
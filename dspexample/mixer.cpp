@@ -0,0 +1,82 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   mixer.cpp
+ *         Mixing of the live input with the files being played
+ * \author Pablo Alvarado
+ * \date   2011.10.26
+ *
+ * $Id: mixer.cpp $
+ */
+
+#include "mixer.h"
+#include "simd.h"
+
+mixer::mixer() : inputGain_(1.0f) {
+  for (int v=0;v<MaxVoices;++v) {
+    sources_[v].store(0);
+    active_[v].store(false);
+    gains_[v].store(1.0f);
+  }
+}
+
+void mixer::mix(const float* in,float* out,const int n) {
+  simd::scale(out,in,inputGain_.load(std::memory_order_relaxed),n);
+
+  for (int v=0;v<MaxVoices;++v) {
+    if (active_[v].load(std::memory_order_acquire)) {
+      sampleRing* ring=sources_[v].load(std::memory_order_acquire);
+      if (ring!=0) {
+        ring->mix(out,n,gains_[v].load(std::memory_order_relaxed));
+      }
+    }
+  }
+}
+
+sampleRing* mixer::exchange(const int voice,sampleRing* ring) {
+  return sources_[voice].exchange(ring,std::memory_order_acq_rel);
+}
+
+sampleRing* mixer::source(const int voice) const {
+  return sources_[voice].load(std::memory_order_acquire);
+}
+
+void mixer::setActive(const int voice,const bool active) {
+  active_[voice].store(active,std::memory_order_release);
+}
+
+bool mixer::active(const int voice) const {
+  return active_[voice].load(std::memory_order_acquire);
+}
+
+void mixer::setGain(const int voice,const float gain) {
+  gains_[voice].store(gain,std::memory_order_relaxed);
+}
+
+float mixer::gain(const int voice) const {
+  return gains_[voice].load(std::memory_order_relaxed);
+}
+
+void mixer::setInputGain(const float gain) {
+  inputGain_.store(gain,std::memory_order_relaxed);
+}
+
+float mixer::inputGain() const {
+  return inputGain_.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,137 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   mixer.h
+ *         Mixing of the live input with the files being played
+ * \author Pablo Alvarado
+ * \date   2011.10.26
+ *
+ * $Id: mixer.h $
+ */
+
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <atomic>
+
+#include "samplering.h"
+
+/**
+ * Source stage of the processing chain.
+ *
+ * The signal given to the processor is the live input plus any number of
+ * voices, each one scaled by its own gain:
+ * \f[
+ * x(n)=g_{in}\,i(n)+\sum_{v} g_v\,f_v(n)
+ * \f]
+ * where \f$f_v(n)\f$ is the signal of the files played by voice v.  The
+ * files are decoded ahead of time by the file thread into one sampleRing
+ * per voice, and mix() accumulates straight from the rings, so that each
+ * active voice costs one vectorized scaled addition per block.  A voice
+ * whose ring runs empty adds silence.
+ *
+ * mix() is called by the JACK process thread and never waits.  The rings
+ * are replaced with exchange() while it may be running: the caller owns
+ * the rings, and must keep the replaced one until the process thread has
+ * started a new block.
+ */
+class mixer {
+public:
+  /**
+   * Some constants
+   */
+  enum {
+    MaxVoices=8 /**< voices mixed at most */
+  };
+
+  /**
+   * Constructor.  No voice is active, and all gains are one.
+   */
+  mixer();
+
+  /**
+   * Mix the n samples of the live input with the active voices
+   */
+  void mix(const float* in,float* out,const int n);
+
+  /**
+   * Replace the ring of the given voice
+   *
+   * @return the ring used before
+   */
+  sampleRing* exchange(const int voice,sampleRing* ring);
+
+  /**
+   * Ring of the given voice
+   */
+  sampleRing* source(const int voice) const;
+
+  /**
+   * Start or stop mixing the given voice
+   */
+  void setActive(const int voice,const bool active);
+
+  /**
+   * True if the given voice is being mixed
+   */
+  bool active(const int voice) const;
+
+  /**
+   * Set the gain of the given voice
+   */
+  void setGain(const int voice,const float gain);
+
+  /**
+   * Gain of the given voice
+   */
+  float gain(const int voice) const;
+
+  /**
+   * Set the gain of the live input
+   */
+  void setInputGain(const float gain);
+
+  /**
+   * Gain of the live input
+   */
+  float inputGain() const;
+
+protected:
+  /**
+   * Rings of the voices
+   */
+  std::atomic<sampleRing*> sources_[MaxVoices];
+
+  /**
+   * Voices being mixed
+   */
+  std::atomic<bool> active_[MaxVoices];
+
+  /**
+   * Gains of the voices
+   */
+  std::atomic<float> gains_[MaxVoices];
+
+  /**
+   * Gain of the live input
+   */
+  std::atomic<float> inputGain_;
+};
+
+#endif // MIXER_H
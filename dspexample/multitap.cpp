@@ -0,0 +1,186 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   multitap.cpp
+ *         Implements a multi-tap delay line
+ * \author Pablo Alvarado
+ * \date   2011.10.17
+ *
+ * $Id: multitap.cpp $
+ */
+
+#include "multitap.h"
+#include "simd.h"
+#include <cmath>
+#include <cstring>
+
+// Early reflections and echoes do not need the long delays of the simple
+// reverb
+
+const float multiTap::MaxDelay = 2000.0f;
+
+multiTap::multiTap()
+  : ringBuffer_(0),ringBufferSize_(0),idx_(0),blockSize_(0),taps_(0),
+    sampleRate_(0) {
+}
+
+/*
+ * Destructor
+ */
+multiTap::~multiTap() {
+  delete[] ringBuffer_;
+  ringBufferSize_=0;
+}
+
+/*
+ * Init the filter operation
+ */
+void multiTap::init(int sampleRate,
+                    int blockSize) {
+  sampleRate_=sampleRate;
+
+  // the whole block is written before the taps are read, so the ring has
+  // to hold it besides the longest delay
+  int k = MaxDelay*sampleRate_/1000.0f + blockSize;
+
+  // find the next base-2 number that can hold the required sample number
+  ringBufferSize_ = 1 << static_cast<int>(ceil(log(k+1)/log(2.0f)));
+  delete[] ringBuffer_;
+  ringBuffer_ = new float[ringBufferSize_];
+
+  blockSize_ = ringBufferSize_ - static_cast<int>(MaxDelay*sampleRate_/1000.0f);
+
+  reset(); /* initial conds. 0 */
+}
+
+int multiTap::samples(float delay) const {
+  // ensure the set delay is valid
+  if (delay>MaxDelay) {
+    delay=MaxDelay;
+  }
+  const int k = static_cast<int>(delay*sampleRate_/1000.0f+0.5f);
+  return (k<0) ? 0 : k;
+}
+
+int multiTap::setTaps(int taps,
+                      const float* delays,
+                      const float* gains) {
+  if (taps>MaxTaps) {
+    taps=MaxTaps;
+  }
+  for (int t=0;t<taps;++t) {
+    k_[t]=samples(delays[t]);
+    gain_[t]=gains[t];
+  }
+  taps_=(taps<0) ? 0 : taps;
+  return taps_;
+}
+
+bool multiTap::addTap(float delay,
+                      float gain) {
+  if (taps_>=MaxTaps) {
+    return false;
+  }
+  k_[taps_]=samples(delay);
+  gain_[taps_]=gain;
+  ++taps_;
+  return true;
+}
+
+void multiTap::clearTaps() {
+  taps_=0;
+}
+
+int multiTap::getTaps() const {
+  return taps_;
+}
+
+float multiTap::getDelay(int tap) const {
+  return 1000.0f*float(k_[tap])/float(sampleRate_);
+}
+
+float multiTap::getGain(int tap) const {
+  return gain_[tap];
+}
+
+/**
+ * Filter the in buffer and leave the result in out
+ */
+void multiTap::filter(int blockSize,
+                      const float* in,
+                      float* out) {
+  while (blockSize>0) {
+    const int n = (blockSize<blockSize_) ? blockSize : blockSize_;
+    filterBlock(n,in,out);
+    in+=n;
+    out+=n;
+    blockSize-=n;
+  }
+}
+
+void multiTap::filterBlock(int blockSize,
+                           const float* in,
+                           float* out) {
+  // the following works because the ringBuffer was set with a size
+  // equal to 2^n.
+  const int mask = ringBufferSize_-1;
+
+  // first store the whole block
+  int first = ringBufferSize_-idx_;
+  if (first>blockSize) {
+    first=blockSize;
+  }
+  memcpy(ringBuffer_+idx_,in,first*sizeof(float));
+  memcpy(ringBuffer_,in+first,(blockSize-first)*sizeof(float));
+
+  // and then accumulate the contiguous segment read by each tap
+  memset(out,0,blockSize*sizeof(float));
+  for (int t=0;t<taps_;++t) {
+    const int start = (idx_-k_[t]) & mask; // performing modulo with bitwise and
+    int len = ringBufferSize_-start;
+    if (len>blockSize) {
+      len=blockSize;
+    }
+    simd::axpy(out,ringBuffer_+start,gain_[t],len);
+    simd::axpy(out+len,ringBuffer_,gain_[t],blockSize-len);
+  }
+
+  idx_ = (idx_+blockSize) & mask;
+}
+
+/*
+ * Reset
+ */
+void multiTap::reset() {
+  memset(ringBuffer_,0,sizeof(float)*ringBufferSize_);/* initial conds. 0 */
+  idx_=0;
+}
+
+/*
+ * The output depends on the input up to the longest tap
+ */
+int multiTap::tailLength() const {
+  int k=0;
+  for (int t=0;t<taps_;++t) {
+    if (k_[t]>k) {
+      k=k_[t];
+    }
+  }
+  return k;
+}
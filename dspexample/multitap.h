@@ -0,0 +1,198 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   multitap.h
+ *         Implements a multi-tap delay line
+ * \author Pablo Alvarado
+ * \date   2011.10.17
+ *
+ * $Id: multitap.h $
+ */
+
+#ifndef MULTITAP_H
+#define MULTITAP_H
+
+/**
+ * Multi-tap delay
+ *
+ * This FIR filter produces a set of delayed and scaled replicas of the
+ * input, as used for early reflections and echo patterns:
+ * \f[
+ * y(n)=\sum_{t=0}^{T-1} g_t x(n-k_t)
+ * \f]
+ *
+ * All taps read from one single ring buffer, so that memory and cache
+ * traffic do not grow with the number of taps.  Each input block is
+ * written into the ring before any tap is read, and therefore every tap,
+ * even those shorter than the block, reads one contiguous segment (two,
+ * if it wraps around the end of the ring), which is accumulated into the
+ * output with a vectorized scaled addition.
+ */
+class multiTap {
+public:
+  /**
+   * Constructor
+   */
+  multiTap();
+
+  /**
+   * Destructor
+   */
+  ~multiTap();
+
+  /**
+   * Init the filter operation
+   *
+   * @param sampleRate used sample rate
+   * @param blockSize largest block size passed to filter().  Larger blocks
+   *                  are still accepted, but processed in pieces.
+   */
+  void init(int sampleRate,
+            int blockSize);
+
+  /**
+   * Filter the in buffer and leave the result in out.
+   *
+   * The in and out buffers must not overlap.
+   */
+  void filter(int blockSize,
+              const float* in,
+              float* out);
+
+  /**
+   * Replace the whole tap table.
+   *
+   * @param taps number of taps.  At most MaxTaps are taken.
+   * @param delays delay of each tap in ms.  Each one must be less than
+   *               MaxDelay.
+   * @param gains gain of each tap.
+   * @return number of taps actually set
+   */
+  int setTaps(int taps,
+              const float* delays,
+              const float* gains);
+
+  /**
+   * Add one tap to the table
+   *
+   * @return false if the table is already full
+   */
+  bool addTap(float delay,
+              float gain);
+
+  /**
+   * Remove all taps
+   */
+  void clearTaps();
+
+  /**
+   * Number of taps in use
+   */
+  int getTaps() const;
+
+  /**
+   * Delay of the given tap in ms
+   */
+  float getDelay(int tap) const;
+
+  /**
+   * Gain of the given tap
+   */
+  float getGain(int tap) const;
+
+  /**
+   * Reset the delay line
+   */
+  void reset();
+
+  /**
+   * Number of samples the output keeps depending on past input, i.e. the
+   * longest tap delay
+   */
+  int tailLength() const;
+
+  /**
+   * Constant that defines what is the maximum delay allowed in ms
+   */
+  static const float MaxDelay;
+
+  /**
+   * Some constants
+   */
+  enum {
+    MaxTaps=512
+  };
+
+protected:
+  /**
+   * Ring buffer
+   *
+   * This will have a 2^n size to facilitate the modulo computation
+   */
+  float* ringBuffer_;
+
+  /**
+   * Ring buffer size
+   */
+  int ringBufferSize_;
+
+  /**
+   * Index in the ring buffer where the next input sample is written
+   */
+  int idx_;
+
+  /**
+   * Largest block that fits in the ring buffer together with MaxDelay
+   */
+  int blockSize_;
+
+  /**
+   * Number of taps in use
+   */
+  int taps_;
+
+  /**
+   * Delay of each tap in samples
+   */
+  int k_[MaxTaps];
+
+  /**
+   * Gain of each tap
+   */
+  float gain_[MaxTaps];
+
+  /**
+   * Sample rate
+   */
+  int sampleRate_;
+
+  /**
+   * Convert a delay in ms into a valid number of samples
+   */
+  int samples(float delay) const;
+
+  /**
+   * Filter a block of at most blockSize_ samples
+   */
+  void filterBlock(int blockSize,
+                   const float* in,
+                   float* out);
+};
+
+#endif // MULTITAP_H
@@ -0,0 +1,221 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   paralleldecoder.cpp
+ *         Decoding of compressed files by several threads
+ * \author Pablo Alvarado
+ * \date   2011.10.25
+ *
+ * $Id: paralleldecoder.cpp $
+ */
+
+#include "paralleldecoder.h"
+#include "simd.h"
+
+#include <cstring>
+#include <QThread>
+
+parallelDecoder::parallelDecoder()
+  : slots_(0),numSlots_(0),channels_(0),frames_(0),nextStart_(0),
+    current_(0),offset_(0),failed_(false) {
+}
+
+parallelDecoder::~parallelDecoder() {
+  close();
+}
+
+QThreadPool& parallelDecoder::pool() {
+  static QThreadPool threads;
+  static bool init=false;
+  if (!init) {
+    threads.setMaxThreadCount(QThread::idealThreadCount());
+    init=true;
+  }
+  return threads;
+}
+
+bool parallelDecoder::suitable(const SF_INFO& info) {
+  const int type=info.format & SF_FORMAT_TYPEMASK;
+  const int sub=info.format & SF_FORMAT_SUBMASK;
+  const bool compressed = (type==SF_FORMAT_FLAC) ||
+                          ((type==SF_FORMAT_OGG) && (sub==SF_FORMAT_VORBIS));
+  return compressed && info.seekable && (info.channels>0) &&
+         (info.frames>=2LL*ChunkFrames) && (info.frames<(1LL<<40));
+}
+
+bool parallelDecoder::open(const char* filename,const SF_INFO& info,
+                           long long ahead,std::string& error) {
+  close();
+
+  channels_=info.channels;
+  frames_=info.frames;
+  nextStart_=0;
+  current_=0;
+  offset_=0;
+  failed_=false;
+
+  // the chunks buffered by the reader plus the one being read, but no
+  // more than two per thread
+  const long long needed=(ahead+ChunkFrames-1)/ChunkFrames+1;
+  const int most=2*QThread::idealThreadCount();
+  numSlots_ = (needed<most) ? static_cast<int>(needed) : most;
+  if (numSlots_<MinSlots) {
+    numSlots_=MinSlots;
+  }
+  // all slots are valid before any file is opened, since close() may
+  // release them after a failure
+  slots_=new slot[numSlots_]();
+  for (int i=0;i<numSlots_;++i) {
+    slots_[i].start=-1;
+  }
+
+  for (int i=0;i<numSlots_;++i) {
+    slot& s=slots_[i];
+    SF_INFO tmp;
+    tmp.format=0;
+    s.file=sf_open(filename,SFM_READ,&tmp);
+    if (s.file==0) {
+      error = std::string("Error opening file ") + filename + ": " +
+              sf_strerror(0);
+      close();
+      return false;
+    }
+    if (tmp.channels!=channels_) {
+      error = std::string("Error opening file ") + filename +
+              ": the number of channels changed";
+      close();
+      return false;
+    }
+    s.buffer=new float[ChunkFrames*channels_];
+    s.mono=new float[ChunkFrames];
+  }
+
+  for (int i=0;i<numSlots_;++i) {
+    schedule(slots_[i]);
+  }
+  return true;
+}
+
+void parallelDecoder::close() {
+  if (slots_==0) {
+    return;
+  }
+
+  // the jobs still write into the slots
+  lock_.lock();
+  for (int i=0;i<numSlots_;++i) {
+    while (slots_[i].busy) {
+      done_.wait(&lock_);
+    }
+  }
+  lock_.unlock();
+
+  for (int i=0;i<numSlots_;++i) {
+    if (slots_[i].file!=0) {
+      sf_close(slots_[i].file);
+    }
+    delete[] slots_[i].buffer;
+    delete[] slots_[i].mono;
+  }
+  delete[] slots_;
+  slots_=0;
+  numSlots_=0;
+}
+
+void parallelDecoder::schedule(slot& s) {
+  s.frames=0;
+  if (nextStart_>=frames_) {
+    s.start=-1;
+    return;
+  }
+  s.start=nextStart_;
+  nextStart_+=ChunkFrames;
+
+  lock_.lock();
+  s.busy=true;
+  lock_.unlock();
+  pool().start(new job(this,&s));
+}
+
+void parallelDecoder::job::run() {
+  d_->decode(*s_);
+}
+
+void parallelDecoder::decode(slot& s) {
+  const long long left=frames_-s.start;
+  const int n = (left<ChunkFrames) ? static_cast<int>(left) : int(ChunkFrames);
+
+  int got=0;
+  if (sf_seek(s.file,s.start,SEEK_SET)==s.start) {
+    got=static_cast<int>(sf_readf_float(s.file,s.buffer,n));
+    if (got<0) {
+      got=0;
+    }
+  }
+  simd::downmix(s.buffer,s.mono,got,channels_);
+
+  lock_.lock();
+  s.frames=got;
+  s.busy=false;
+  done_.wakeAll();
+  lock_.unlock();
+}
+
+int parallelDecoder::read(float* out,int frames) {
+  int cnt=0;
+  while ((cnt<frames) && (slots_!=0) && !failed_) {
+    slot& s=slots_[current_];
+
+    lock_.lock();
+    while (s.busy) {
+      done_.wait(&lock_);
+    }
+    lock_.unlock();
+
+    if (s.start<0) {
+      break; // end of the file
+    }
+
+    int n=s.frames-offset_;
+    if (n>frames-cnt) {
+      n=frames-cnt;
+    }
+    memcpy(out+cnt,s.mono+offset_,n*sizeof(float));
+    offset_+=n;
+    cnt+=n;
+
+    if (offset_>=s.frames) {
+      // a chunk cut short by a decoding error: the chunks after it would
+      // leave a gap
+      long long expected=frames_-s.start;
+      if (expected>ChunkFrames) {
+        expected=ChunkFrames;
+      }
+      if (s.frames<expected) {
+        failed_=true;
+      }
+
+      // the slot takes the next chunk, and the following slot is read
+      schedule(s);
+      current_=(current_+1)%numSlots_;
+      offset_=0;
+    }
+  }
+  return cnt;
+}
@@ -0,0 +1,194 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   paralleldecoder.h
+ *         Decoding of compressed files by several threads
+ * \author Pablo Alvarado
+ * \date   2011.10.25
+ *
+ * $Id: paralleldecoder.h $
+ */
+
+#ifndef PARALLELDECODER_H
+#define PARALLELDECODER_H
+
+#include <sndfile.h>
+#include <string>
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+
+/**
+ * Parallel decoder of compressed files (FLAC and Ogg Vorbis).
+ *
+ * Decoding these formats is much more expensive than reading them, and a
+ * single thread limits how fast a long file can be processed.  Since
+ * libsndfile seeks to the exact frame in both formats, the file is split
+ * in chunks of ChunkFrames frames that are decoded independently.
+ *
+ * Each chunk is decoded and downmixed to mono by a job of a thread pool
+ * shared by all decoders, into one of several slots.  Every slot has its
+ * own handle of the file, so the jobs do not share any decoder state.
+ * read() delivers the chunks in order: when a slot has been consumed it is
+ * given the next chunk not yet requested, so that as many chunks as slots
+ * are decoded ahead of the reader.  There are only enough slots to cover
+ * what the reader buffers itself, since decoding further ahead would just
+ * hold memory.
+ */
+class parallelDecoder {
+public:
+  /**
+   * Constructor
+   */
+  parallelDecoder();
+
+  /**
+   * Destructor.  Waits for the chunks being decoded.
+   */
+  ~parallelDecoder();
+
+  /**
+   * True if the file described by info is worth decoding in parallel:
+   * a seekable FLAC or Ogg Vorbis file of several chunks
+   */
+  static bool suitable(const SF_INFO& info);
+
+  /**
+   * Open the file described by info and start decoding its first chunks
+   *
+   * @param ahead frames of the file the reader keeps buffered
+   * @return true if successful
+   */
+  bool open(const char* filename,const SF_INFO& info,long long ahead,
+            std::string& error);
+
+  /**
+   * Deliver the next frames downmixed to mono, at the rate of the file
+   *
+   * @return number of frames delivered.  Less than requested means the end
+   *         of the file was reached.
+   */
+  int read(float* out,int frames);
+
+  /**
+   * Some constants
+   */
+  enum {
+    ChunkFrames=65536, /**< frames of each independently decoded chunk */
+    MinSlots=2         /**< slots in use, at least */
+  };
+
+protected:
+  /**
+   * A chunk being decoded or ready to be read
+   */
+  struct slot {
+    SNDFILE* file;   /**< handle used only for this slot */
+    float* buffer;   /**< interleaved samples as decoded */
+    float* mono;     /**< samples downmixed */
+    long long start; /**< first frame of the chunk, or -1 past the end */
+    int frames;      /**< frames in mono */
+    bool busy;       /**< being decoded, protected by lock_ */
+  };
+
+  /**
+   * Job of the thread pool
+   */
+  class job : public QRunnable {
+  public:
+    job(parallelDecoder* d,slot* s) : d_(d),s_(s) {}
+    virtual void run();
+  protected:
+    parallelDecoder* d_;
+    slot* s_;
+  };
+
+  /**
+   * Give the next chunk to the slot, and start decoding it
+   */
+  void schedule(slot& s);
+
+  /**
+   * Decode the chunk of the slot (thread pool)
+   */
+  void decode(slot& s);
+
+  /**
+   * Wait for all jobs and release the slots
+   */
+  void close();
+
+  /**
+   * Pool shared by all decoders, with one thread per core
+   */
+  static QThreadPool& pool();
+
+  /**
+   * Slots, used in circular order
+   */
+  slot* slots_;
+
+  /**
+   * Number of slots
+   */
+  int numSlots_;
+
+  /**
+   * Channels of the file
+   */
+  int channels_;
+
+  /**
+   * Frames of the file
+   */
+  long long frames_;
+
+  /**
+   * First frame of the next chunk to be scheduled
+   */
+  long long nextStart_;
+
+  /**
+   * Slot being read
+   */
+  int current_;
+
+  /**
+   * Frames of the current slot already delivered
+   */
+  int offset_;
+
+  /**
+   * A chunk could not be decoded completely: nothing follows it
+   */
+  bool failed_;
+
+  /**
+   * Protects the busy flags
+   */
+  QMutex lock_;
+
+  /**
+   * Signaled whenever a chunk is done
+   */
+  QWaitCondition done_;
+};
+
+#endif // PARALLELDECODER_H
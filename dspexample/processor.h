@@ -46,15 +46,23 @@ public:
 
   /**
    * Initialization function for the current filter plan
+   *
+   * @param frameRate sample rate
+   * @param bufferSize maximum number of frames given to each process() call
    */
   virtual bool init(const int frameRate,
                     const int bufferSize)=0;
 
   /**
    * Processing function
+   *
+   * Any number of frames up to the buffer size given at init() can be
+   * processed in each call.  The input is never modified, and it may be the
+   * same buffer as the output.
    */
-  virtual bool process(float* in,
-                       float* out)=0;
+  virtual bool process(const float* in,
+                       float* out,
+                       const int nframes)=0;
 
   /**
    * Shutdown the processor
@@ -0,0 +1,181 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   reclaimer.h
+ *         Deferred release of memory still in use by the real-time thread
+ * \author Pablo Alvarado
+ * \date   2011.10.19
+ *
+ * $Id: reclaimer.h $
+ */
+
+#ifndef RECLAIMER_H
+#define RECLAIMER_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Quiescent-state based reclamation for one real-time reader thread.
+ *
+ * A buffer, filter or any other object replaced while the real-time thread
+ * may still be using it is handed to retire() instead of being deleted.
+ * The real-time thread calls quiescent() between blocks, i.e. at a point
+ * where it holds no pointer obtained in a previous block.  Each retired
+ * object is freed by collect() only once the real-time thread has passed
+ * such a point after the object was retired.
+ *
+ * Replacing an object is done in this order:
+ *  -# publish the new pointer, where the real-time thread takes it
+ *  -# retire() the old one
+ *  -# call collect() now or later, from any non real-time thread
+ *
+ * The real-time side is wait-free and does not allocate: quiescent() is
+ * just two atomic operations.  The other side is protected by a mutex, so
+ * that several threads may retire and collect.
+ */
+class reclaimer {
+public:
+  reclaimer() : epoch_(0),seen_(0) {
+  }
+
+  /**
+   * Free everything still pending.  The real-time thread must have stopped.
+   */
+  ~reclaimer() {
+    collectAll();
+  }
+
+  /**
+   * Announce that no pointer taken before this call is in use anymore
+   * (real-time thread, once per block)
+   */
+  void quiescent() {
+    seen_.store(epoch_.load());
+  }
+
+  /**
+   * Delete the given object with delete once it is safe
+   */
+  template<typename T>
+  void retire(T* ptr) {
+    defer(ptr,&deleteObject<T>);
+  }
+
+  /**
+   * Delete the given array with delete[] once it is safe
+   */
+  template<typename T>
+  void retireArray(T* ptr) {
+    defer(ptr,&deleteArray<T>);
+  }
+
+  /**
+   * Free the retired objects the real-time thread cannot see anymore
+   */
+  void collect() {
+    std::lock_guard<std::mutex> guard(lock_);
+    const uint64_t seen=seen_.load();
+
+    // the list is sorted by epoch
+    std::vector<entry>::iterator it=retired_.begin();
+    while ((it!=retired_.end()) && (it->epoch<=seen)) {
+      it->release(it->ptr);
+      ++it;
+    }
+    retired_.erase(retired_.begin(),it);
+  }
+
+  /**
+   * Free all retired objects.  Only to be called when the real-time thread
+   * is not running.
+   */
+  void collectAll() {
+    std::lock_guard<std::mutex> guard(lock_);
+    for (std::vector<entry>::iterator it=retired_.begin();
+         it!=retired_.end();
+         ++it) {
+      it->release(it->ptr);
+    }
+    retired_.clear();
+  }
+
+  /**
+   * Number of objects still waiting to be freed
+   */
+  int pending() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return static_cast<int>(retired_.size());
+  }
+
+private:
+  /**
+   * A retired object
+   */
+  struct entry {
+    void* ptr;
+    void (*release)(void*);
+    uint64_t epoch; /**< the object is free after seen_ reaches this */
+  };
+
+  template<typename T>
+  static void deleteObject(void* ptr) {
+    delete static_cast<T*>(ptr);
+  }
+
+  template<typename T>
+  static void deleteArray(void* ptr) {
+    delete[] static_cast<T*>(ptr);
+  }
+
+  void defer(void* ptr,void (*release)(void*)) {
+    if (ptr==0) {
+      return;
+    }
+    std::lock_guard<std::mutex> guard(lock_);
+    // the new epoch is reached only by a quiescent() after this point,
+    // and thus after the pointer was unpublished
+    const entry e = { ptr, release, epoch_.fetch_add(1)+1 };
+    retired_.push_back(e);
+  }
+
+  /**
+   * Incremented on each retire()
+   */
+  std::atomic<uint64_t> epoch_;
+
+  /**
+   * Last epoch seen by the real-time thread at a quiescent point
+   */
+  std::atomic<uint64_t> seen_;
+
+  /**
+   * Objects waiting to be freed, in retire order
+   */
+  std::vector<entry> retired_;
+
+  /**
+   * Protects retired_
+   */
+  mutable std::mutex lock_;
+};
+
+#endif // RECLAIMER_H
@@ -26,8 +26,11 @@
  */
 
 #include "reverb.h"
+#include "simd.h"
 #include <cmath>
 #include <cstring>
+#include <limits>
+
 
 // 4000ms is the maximal allowed delay, to avoid the ring-buffer being too
 // large (this is indeed too large for an efficient DSP (line TI C67x
@@ -35,8 +38,10 @@
 
 const float reverb::MaxDelay = 4000.0f;
 
-reverb::reverb()
-  : ringBuffer_(0),ringBufferSize_(0),k_(0),alpha_(0.0f),idx_(0),sampleRate_(0){
+reverb::reverb(bool halfPrecision)
+  : halfPrecision_(halfPrecision),ringBuffer_(0),halfRingBuffer_(0),
+    ringBufferSize_(0),k_(fracDelay::MinDelay),alpha_(0.0f),
+    idx_(0),sampleRate_(0){
 }
 
 /*
@@ -44,6 +49,7 @@ reverb::reverb()
  */
 reverb::~reverb() {
   delete[] ringBuffer_;
+  delete[] halfRingBuffer_;
   ringBufferSize_=0;
 }
 
@@ -58,57 +64,139 @@ void reverb::init(int sampleRate,
   if (sampleRate!=sampleRate_) {
     sampleRate_=sampleRate;
 
-    int k = MaxDelay*sampleRate_/1000.0f;
+    // the interpolation reads a few samples beyond the delay
+    int k = MaxDelay*sampleRate_/1000.0f + fracDelay::Span;
 
     // find the next base-2 number that can hold the required sample number
     ringBufferSize_ = 1 << static_cast<int>(ceil(log(k+1)/log(2.0f)));
     delete[] ringBuffer_;
-    ringBuffer_ = new float[ringBufferSize_];
-    memset(ringBuffer_,0,sizeof(float)*ringBufferSize_);/* initial conds. 0 */
+    ringBuffer_ = 0;
+    delete[] halfRingBuffer_;
+    halfRingBuffer_ = 0;
+    if (halfPrecision_) {
+      halfRingBuffer_ = new uint16_t[ringBufferSize_];
+    } else {
+      ringBuffer_ = new float[ringBufferSize_];
+    }
+    reset(); /* initial conds. 0 */
   }
 
- setDelay(delay);
- setAlpha(alpha);
+  setDelay(delay);
+  setAlpha(alpha);
+
+  // no ramp on initialization
+  k_.jump(k_.target());
+  alpha_.jump(alpha_.target());
 
   idx_=0;
 }
 
 void reverb::setAlpha(float alpha) {
-  alpha_ = (alpha<-1.0f) ? -1.0f : (alpha>1.0f) ? 1.0: alpha;
+  if (!std::isfinite(alpha)) {
+    return;
+  }
+  alpha_.set((alpha<-1.0f) ? -1.0f : (alpha>1.0f) ? 1.0f : alpha);
 }
 
 void reverb::setDelay(float delay) {
+  if (!std::isfinite(delay)) {
+    return;
+  }
   // ensure the set delay is valid
   if (delay>MaxDelay) {
     delay=MaxDelay;
   }
 
-  k_ = delay*sampleRate_/1000.0f;
+  float k = delay*sampleRate_/1000.0f;
 
-  if (k_ < 1) {
-    k_=1;
+  if (k < fracDelay::MinDelay) {
+    k=fracDelay::MinDelay;
   }
 
+  // the ring buffer is not touched: the new delay is reached with a ramp
+  k_.set(k);
 }
 
 /**
  * Filter the in buffer and leave the result in out
  */
 void reverb::filter(int blockSize,
-                        float* in,
+                    const float* in,
+                    float* out) {
+  if (halfRingBuffer_!=0) {
+    filterRing(halfRingBuffer_,blockSize,in,out);
+  } else {
+    filterRing(ringBuffer_,blockSize,in,out);
+  }
+}
+
+/*
+ * Filter on a ring buffer with float or half precision samples
+ */
+template<typename S>
+void reverb::filterRing(S* ring,
+                        int blockSize,
+                        const float* in,
                         float* out) {
 
   // the following works because the ringBuffer was set with a size
   // equal to 2^n.
   const int mask = ringBufferSize_-1;
-  const float nalpha=1.0f-alpha_;
 
-  for (int n=0;n<blockSize;++n) {
-    int nmk=(idx_-k_) & mask; // performing modulo with bitwise and
+  const bool kRamp = k_.begin(blockSize);
+  const bool alphaRamp = alpha_.begin(blockSize);
+
+  if (kRamp || alphaRamp) {
+    // parameters change from sample to sample
+    for (int n=0;n<blockSize;++n) {
+      const float alpha=alpha_.next();
+      const float ynmk=fracDelay::read(ring,mask,idx_,k_.next());
+
+      // y(n) = a*y(n-k) + (1-a)*x(n)
+      out[n] = simd::flushDenormal(alpha*ynmk+(1.0f-alpha)*in[n]);
+      simd::store(ring+idx_,out[n]);
+      idx_ = (idx_+1) & mask;
+    }
+    return;
+  }
+
+  const float alpha=alpha_.value();
+  const float nalpha=1.0f-alpha;
+  float c[fracDelay::Span];
+  const int i=fracDelay::coefficients(k_.value(),c);
+
+#ifdef __SSE__
+  const __m128 vc[fracDelay::Span] = {
+    _mm_set1_ps(c[0]),_mm_set1_ps(c[1]),_mm_set1_ps(c[2]),_mm_set1_ps(c[3])
+  };
+  const __m128 valpha=_mm_set1_ps(alpha);
+  const __m128 vnalpha=_mm_set1_ps(nalpha);
+#endif
+
+  int n=0;
+  while (n<blockSize) {
+#ifdef __SSE__
+    // four samples at once, if they do not depend on each other
+    if ((n+4<=blockSize) &&
+        fracDelay::vectorizable(ringBufferSize_,idx_,i)) {
+      const __m128 ynmk=fracDelay::read4(ring,idx_,i,vc);
+      const __m128 yn=simd::flushDenormal(
+                         _mm_add_ps(_mm_mul_ps(valpha,ynmk),
+                                    _mm_mul_ps(vnalpha,_mm_loadu_ps(in+n))));
+      simd::store4(ring+idx_,yn);
+      _mm_storeu_ps(out+n,yn);
+      idx_ = (idx_+4) & mask;
+      n+=4;
+      continue;
+    }
+#endif
+    const float ynmk=fracDelay::read(ring,mask,idx_,i,c);
 
     // y(n) = a*y(n-k) + (1-a)*x(n)
-    ringBuffer_[idx_] = out[n] = alpha_*ringBuffer_[nmk]+nalpha*in[n];
+    out[n] = simd::flushDenormal(alpha*ynmk+nalpha*in[n]);
+    simd::store(ring+idx_,out[n]);
     idx_ = (idx_+1) & mask;
+    ++n;
   }
 }
 
@@ -116,20 +204,46 @@ void reverb::filter(int blockSize,
  * Reset
  */
 void reverb::reset() {
-  memset(ringBuffer_,0,sizeof(float)*ringBufferSize_);/* initial conds. 0 */
+  /* initial conds. 0 */
+  if (halfRingBuffer_!=0) {
+    memset(halfRingBuffer_,0,sizeof(uint16_t)*ringBufferSize_);
+  } else {
+    memset(ringBuffer_,0,sizeof(float)*ringBufferSize_);
+  }
+}
+
+/*
+ * Number of samples the output needs to decay below epsilon
+ */
+int reverb::tailLength(float epsilon) const {
+  const float a = fabs(alpha_.target());
+  if (a <= 0.0f) {
+    return 0;
+  }
+  if (a >= 1.0f) {
+    return std::numeric_limits<int>::max(); // it never decays
+  }
+  // every k_ samples the replica is attenuated by alpha.  With alpha close
+  // to one this does not fit in an int.
+  const double tail = ceil(log(double(epsilon))/log(double(a)))*
+                      ceil(double(k_.target()));
+  if (!(tail < double(std::numeric_limits<int>::max()))) {
+    return std::numeric_limits<int>::max();
+  }
+  return static_cast<int>(tail);
 }
 
 /*
  * Return alpha value in use.
  */
 float reverb::getAlpha() const {
-  return alpha_;
+  return alpha_.target();
 }
 
 /*
  * Return delay value in use, in miliseconds.
  */
 float reverb::getDelay() const {
-  return 1000.0f*float(k_)/float(sampleRate_);
+  return 1000.0f*k_.target()/float(sampleRate_);
 }
 
@@ -28,6 +28,9 @@
 #ifndef REVERB_H
 #define REVERB_H
 
+#include "fracdelay.h"
+#include <cstdint>
+
 /**
  * Reverberation class
  *
@@ -37,13 +40,21 @@
  * \f[
  * y(n)=(1-\alpha)x(n) + \alpha y(n-k)
  * \f]
+ *
+ * The delay k may be fractional: y(n-k) is interpolated between the stored
+ * samples.  Changes of the delay or of alpha are ramped over the next
+ * processed block, so that they can be automated without clicks.
  */
 class reverb {
 public:
   /**
    * Constructor
+   *
+   * @param halfPrecision store the delay line in half precision, halving
+   *                      its memory footprint.  The arithmetic is done in
+   *                      single precision anyway.
    */
-  reverb();
+  reverb(bool halfPrecision=false);
 
   /**
    * Destructor
@@ -56,7 +67,7 @@ public:
    * @param sampleRate used sample rate
    * @param delay delay of the replicas in ms (related to k in the difference
    *              equation).  This value must be less than 4000ms and
-   *              larger or equal than 1/sampleRate.
+   *              larger or equal than 2/sampleRate.
    * @param alpha attenuation factor.  Must be between 0 and 1.
    */
   void init(int sampleRate,
@@ -67,7 +78,7 @@ public:
    * Filter the in buffer and leave the result in out
    */
   void filter(int blockSize,
-              float* in,
+              const float* in,
               float* out);
 
   /**
@@ -86,7 +97,7 @@ public:
   void setAlpha(float alpha);
 
   /**
-   * Set delay value
+   * Set delay value, in miliseconds.  Fractions of a sample are allowed.
    */
   void setDelay(float delay);
 
@@ -95,12 +106,23 @@ public:
    */
   void reset();
 
+  /**
+   * Number of samples the output needs to decay below epsilon times the
+   * level of the last input, after the input becomes silent
+   */
+  int tailLength(float epsilon) const;
+
   /**
    * Constant that defines what is the maximum delay allowed in ms
    */
   static const float MaxDelay;
 
 protected:
+  /**
+   * Delay line stored in half precision
+   */
+  bool halfPrecision_;
+
   /**
    * Ring buffer
    *
@@ -108,20 +130,26 @@ protected:
    */
   float* ringBuffer_;
 
+  /**
+   * Ring buffer in half precision, used instead of ringBuffer_ if
+   * halfPrecision_ is set
+   */
+  uint16_t* halfRingBuffer_;
+
   /**
    * Ring buffer size
    */
   int ringBufferSize_;
 
   /**
-   * Delay
+   * Delay, in samples
    */
-  int k_;
+  rampedValue k_;
 
   /**
    * Alpha coefficient
    */
-  float alpha_;
+  rampedValue alpha_;
 
   /**
    * Index of the last processed data in the ring buffer
@@ -133,6 +161,14 @@ protected:
    */
   int sampleRate_;
 
+  /**
+   * Filter with the given ring buffer (float or uint16_t samples)
+   */
+  template<typename S>
+  void filterRing(S* ring,
+                  int blockSize,
+                  const float* in,
+                  float* out);
 
 };
 
@@ -0,0 +1,169 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   samplering.h
+ *         Lock-free ring of samples between two threads
+ * \author Pablo Alvarado
+ * \date   2011.10.21
+ *
+ * $Id: samplering.h $
+ */
+
+#ifndef SAMPLERING_H
+#define SAMPLERING_H
+
+#include <atomic>
+#include <cstring>
+
+#include "simd.h"
+
+/**
+ * Ring buffer of samples between exactly one producer and one consumer
+ * thread.
+ *
+ * It works like spscQueue, but its capacity is given at construction time,
+ * and blocks of samples are copied in and out at once.
+ */
+class sampleRing {
+public:
+  /**
+   * Constructor
+   *
+   * @param capacity minimum number of samples in the ring.  It is rounded
+   *                 up to a power of two.
+   */
+  sampleRing(int capacity) : head_(0),tail_(0) {
+    size_=1;
+    while (size_<capacity) {
+      size_<<=1;
+    }
+    buffer_ = new float[size_];
+  }
+
+  /**
+   * Destructor
+   */
+  ~sampleRing() {
+    delete[] buffer_;
+  }
+
+  /**
+   * Maximum number of samples in the ring
+   */
+  int capacity() const {
+    return size_;
+  }
+
+  /**
+   * Number of samples ready to be read
+   */
+  int available() const {
+    return int(tail_.load(std::memory_order_acquire)-
+               head_.load(std::memory_order_acquire));
+  }
+
+  /**
+   * Number of samples that can be written
+   */
+  int space() const {
+    return size_-available();
+  }
+
+  /**
+   * Append up to n samples (producer side)
+   *
+   * @return number of samples written
+   */
+  int write(const float* data,int n) {
+    const unsigned int t=tail_.load(std::memory_order_relaxed);
+    const int free=size_-int(t-head_.load(std::memory_order_acquire));
+    if (n>free) {
+      n=free;
+    }
+    const int idx=int(t & (size_-1));
+    const int first=(n<size_-idx) ? n : size_-idx;
+    memcpy(buffer_+idx,data,first*sizeof(float));
+    memcpy(buffer_,data+first,(n-first)*sizeof(float));
+    tail_.store(t+n,std::memory_order_release);
+    return n;
+  }
+
+  /**
+   * Take up to n samples (consumer side)
+   *
+   * @return number of samples read
+   */
+  int read(float* data,int n) {
+    const unsigned int h=head_.load(std::memory_order_relaxed);
+    const int ready=int(tail_.load(std::memory_order_acquire)-h);
+    if (n>ready) {
+      n=ready;
+    }
+    const int idx=int(h & (size_-1));
+    const int first=(n<size_-idx) ? n : size_-idx;
+    memcpy(data,buffer_+idx,first*sizeof(float));
+    memcpy(data+first,buffer_,(n-first)*sizeof(float));
+    head_.store(h+n,std::memory_order_release);
+    return n;
+  }
+
+  /**
+   * Take up to n samples and add them, scaled by gain, to data (consumer
+   * side).  The samples are accumulated straight from the ring, without
+   * any intermediate copy.
+   *
+   * @return number of samples taken
+   */
+  int mix(float* data,int n,const float gain) {
+    const unsigned int h=head_.load(std::memory_order_relaxed);
+    const int ready=int(tail_.load(std::memory_order_acquire)-h);
+    if (n>ready) {
+      n=ready;
+    }
+    const int idx=int(h & (size_-1));
+    const int first=(n<size_-idx) ? n : size_-idx;
+    simd::axpy(data,buffer_+idx,gain,first);
+    simd::axpy(data+first,buffer_,gain,n-first);
+    head_.store(h+n,std::memory_order_release);
+    return n;
+  }
+
+protected:
+  /**
+   * Samples
+   */
+  float* buffer_;
+
+  /**
+   * Capacity (a power of two)
+   */
+  int size_;
+
+  /**
+   * Number of samples taken so far (written by the consumer only)
+   */
+  std::atomic<unsigned int> head_;
+
+  /**
+   * Number of samples appended so far (written by the producer only)
+   */
+  std::atomic<unsigned int> tail_;
+};
+
+#endif // SAMPLERING_H
@@ -0,0 +1,333 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   schroederreverb.cpp
+ *         Implements a Schroeder/Freeverb style reverberator
+ * \author Pablo Alvarado
+ * \date   2011.10.09
+ *
+ * $Id: schroederreverb.cpp $
+ */
+
+#include "schroederreverb.h"
+#include "simd.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// The comb delays are much shorter than the ones of the simple reverb,
+// so a smaller maximum keeps the (8 times larger) ring buffer small
+
+const float schroederReverb::MaxDelay = 200.0f;
+
+namespace {
+  /*
+   * Freeverb tunings at 44.1kHz.  They are scaled to the sample rate and to
+   * the desired delay, and then moved to the next prime.
+   */
+  const int combTuning[schroederReverb::Combs] =
+    {1116,1188,1277,1356,1422,1491,1557,1617};
+  const int allpassTuning[schroederReverb::Allpasses] =
+    {556,441,341,225};
+
+  /*
+   * Gain of the input into the comb filters, and feedback of the allpasses
+   */
+  const float inputGain = 0.015f;
+  const float allpassFeedback = 0.5f;
+}
+
+schroederReverb::schroederReverb()
+  : combBuffer_(0),combBufferSize_(0),combIdx_(0),
+    allpassBufferSize_(0),allpassIdx_(0),
+    delay_(0.0f),alpha_(0.0f),damping_(0.2f),wet_(0.5f),sampleRate_(0) {
+  for (int i=0;i<Combs;++i) {
+    combDelay_[i]=1;
+    lowpass_[i]=0.0f;
+  }
+  for (int i=0;i<Allpasses;++i) {
+    allpassBuffer_[i]=0;
+    allpassDelay_[i]=1;
+  }
+}
+
+/*
+ * Destructor
+ */
+schroederReverb::~schroederReverb() {
+  delete[] combBuffer_;
+  combBufferSize_=0;
+  for (int i=0;i<Allpasses;++i) {
+    delete[] allpassBuffer_[i];
+  }
+  allpassBufferSize_=0;
+}
+
+/*
+ * Smallest prime number larger or equal than n
+ */
+int schroederReverb::nextPrime(int n) {
+  if (n<=2) {
+    return 2;
+  }
+  if ((n%2)==0) {
+    ++n;
+  }
+  for (;;n+=2) {
+    bool prime=true;
+    for (int d=3;d*d<=n;d+=2) {
+      if ((n%d)==0) {
+        prime=false;
+        break;
+      }
+    }
+    if (prime) {
+      return n;
+    }
+  }
+}
+
+/*
+ * Init the filter operation
+ */
+void schroederReverb::init(int sampleRate,
+                           float delay,
+                           float alpha) {
+
+  if (sampleRate!=sampleRate_) {
+    sampleRate_=sampleRate;
+
+    int k = MaxDelay*sampleRate_/1000.0f;
+
+    // find the next base-2 number that can hold the required sample number
+    combBufferSize_ = 1 << static_cast<int>(ceil(log(k+1)/log(2.0f)));
+    delete[] combBuffer_;
+    combBuffer_ = new float[combBufferSize_*Combs];
+
+    // the allpass delays do not depend on the set delay, only on the
+    // sample rate
+    int last=0;
+    for (int i=Allpasses-1;i>=0;--i) {
+      int d = nextPrime(allpassTuning[i]*sampleRate_/44100);
+      if (d<=last) {
+        d=nextPrime(last+1);
+      }
+      allpassDelay_[i]=last=d;
+    }
+
+    allpassBufferSize_ = 1 << static_cast<int>(ceil(log(last+1)/log(2.0f)));
+    for (int i=0;i<Allpasses;++i) {
+      delete[] allpassBuffer_[i];
+      allpassBuffer_[i] = new float[allpassBufferSize_];
+    }
+  }
+
+  reset(); /* initial conds. 0 */
+
+  setDelay(delay);
+  setAlpha(alpha);
+}
+
+void schroederReverb::setAlpha(float alpha) {
+  if (!std::isfinite(alpha)) {
+    return;
+  }
+  // above 0.98 the tail becomes practically infinite
+  alpha_ = (alpha<0.0f) ? 0.0f : (alpha>0.98f) ? 0.98f : alpha;
+}
+
+void schroederReverb::setDamping(float damping) {
+  if (!std::isfinite(damping)) {
+    return;
+  }
+  damping_ = (damping<0.0f) ? 0.0f : (damping>1.0f) ? 1.0f : damping;
+}
+
+void schroederReverb::setMix(float wet) {
+  if (!std::isfinite(wet)) {
+    return;
+  }
+  wet_ = (wet<0.0f) ? 0.0f : (wet>1.0f) ? 1.0f : wet;
+}
+
+void schroederReverb::setDelay(float delay) {
+  if (!std::isfinite(delay)) {
+    return;
+  }
+  // ensure the set delay is valid
+  if (delay>MaxDelay) {
+    delay=MaxDelay;
+  }
+
+  const float longest = delay*sampleRate_/1000.0f;
+  const float scale = longest/combTuning[Combs-1];
+
+  // all comb delays have to be different primes, to be mutually prime
+  int last=1;
+  for (int i=0;i<Combs;++i) {
+    int d = nextPrime(static_cast<int>(combTuning[i]*scale+0.5f));
+    if (d<=last) {
+      d=nextPrime(last+1);
+    }
+    combDelay_[i]=last=d;
+  }
+
+  // the primes may have pushed the longest line beyond the ring buffer
+  const int maxDelay = combBufferSize_-1;
+  for (int i=Combs-1;(i>=0) && (combDelay_[i]>maxDelay-(Combs-1-i));--i) {
+    combDelay_[i]=maxDelay-(Combs-1-i);
+  }
+
+  delay_ = 1000.0f*float(combDelay_[Combs-1])/float(sampleRate_);
+}
+
+/**
+ * Filter the in buffer and leave the result in out
+ */
+void schroederReverb::filter(int blockSize,
+                             const float* in,
+                             float* out) {
+
+  // the following works because the ring buffers were set with a size
+  // equal to 2^n.
+  const int mask = combBufferSize_-1;
+  const int apMask = allpassBufferSize_-1;
+  const float damp1 = damping_;
+  const float damp2 = 1.0f-damping_;
+  const float dry = 1.0f-wet_;
+
+#ifdef __AVX2__
+  const __m256i lane  = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+  const __m256i vmask = _mm256_set1_epi32(mask);
+  const __m256i vk    = _mm256_loadu_si256(
+                          reinterpret_cast<const __m256i*>(combDelay_));
+  const __m256 valpha = _mm256_set1_ps(alpha_);
+  const __m256 vdamp1 = _mm256_set1_ps(damp1);
+  const __m256 vdamp2 = _mm256_set1_ps(damp2);
+  __m256 lp = _mm256_loadu_ps(lowpass_);
+#endif
+
+  for (int n=0;n<blockSize;++n) {
+    const float x = inputGain*in[n];
+    float acc;
+
+#ifdef __AVX2__
+    // all 8 lines at once: y(n-k_i) of line i is at ((n-k_i)&mask)*8+i
+    __m256i nmk = _mm256_and_si256(_mm256_sub_epi32(_mm256_set1_epi32(combIdx_),
+                                                    vk),vmask);
+    nmk = _mm256_add_epi32(_mm256_slli_epi32(nmk,3),lane);
+    const __m256 y = _mm256_i32gather_ps(combBuffer_,nmk,4);
+
+    // l(n) = (1-d)*y(n-k) + d*l(n-1)
+    lp = simd::flushDenormal(_mm256_add_ps(_mm256_mul_ps(y,vdamp2),
+                                           _mm256_mul_ps(lp,vdamp1)));
+    // y(n) = g*x(n) + a*l(n)
+    _mm256_storeu_ps(combBuffer_+combIdx_*Combs,
+                     _mm256_add_ps(_mm256_set1_ps(x),
+                                   _mm256_mul_ps(valpha,lp)));
+
+    // sum of all comb outputs
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(y),
+                          _mm256_extractf128_ps(y,1));
+    s = _mm_add_ps(s,_mm_movehl_ps(s,s));
+    s = _mm_add_ss(s,_mm_shuffle_ps(s,s,1));
+    acc = _mm_cvtss_f32(s);
+#else
+    acc = 0.0f;
+    float* w = combBuffer_+combIdx_*Combs;
+    for (int i=0;i<Combs;++i) {
+      const int nmk=(combIdx_-combDelay_[i]) & mask; // modulo with bitwise and
+      const float y = combBuffer_[nmk*Combs+i];
+      lowpass_[i] = simd::flushDenormal(damp2*y + damp1*lowpass_[i]);
+      w[i] = x + alpha_*lowpass_[i];
+      acc += y;
+    }
+#endif
+    combIdx_ = (combIdx_+1) & mask;
+
+    // allpasses in series
+    for (int i=0;i<Allpasses;++i) {
+      float* buf = allpassBuffer_[i];
+      const float bufout = buf[(allpassIdx_-allpassDelay_[i]) & apMask];
+      buf[allpassIdx_] = simd::flushDenormal(acc + allpassFeedback*bufout);
+      acc = bufout - acc;
+    }
+    allpassIdx_ = (allpassIdx_+1) & apMask;
+
+    out[n] = dry*in[n] + wet_*acc;
+  }
+
+#ifdef __AVX2__
+  _mm256_storeu_ps(lowpass_,lp);
+#endif
+}
+
+/*
+ * Reset
+ */
+void schroederReverb::reset() {
+  /* initial conds. 0 */
+  memset(combBuffer_,0,sizeof(float)*combBufferSize_*Combs);
+  for (int i=0;i<Allpasses;++i) {
+    memset(allpassBuffer_[i],0,sizeof(float)*allpassBufferSize_);
+  }
+  for (int i=0;i<Combs;++i) {
+    lowpass_[i]=0.0f;
+  }
+  combIdx_=0;
+  allpassIdx_=0;
+}
+
+/*
+ * Number of samples the output needs to decay below epsilon
+ */
+int schroederReverb::tailLength(float epsilon) const {
+  int tail=0;
+
+  // each round trip through the allpasses attenuates by their feedback
+  const int m = static_cast<int>(ceil(log(epsilon)/log(allpassFeedback)));
+  for (int i=0;i<Allpasses;++i) {
+    tail += m*allpassDelay_[i];
+  }
+
+  // each round trip through the longest comb attenuates (at most) by alpha
+  if (alpha_ > 0.0f) {
+    tail += static_cast<int>(ceil(log(epsilon)/log(alpha_)))*
+            combDelay_[Combs-1];
+  }
+  return tail;
+}
+
+/*
+ * Return alpha value in use.
+ */
+float schroederReverb::getAlpha() const {
+  return alpha_;
+}
+
+/*
+ * Return delay value of the longest comb in use, in miliseconds.
+ */
+float schroederReverb::getDelay() const {
+  return delay_;
+}
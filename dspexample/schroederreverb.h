@@ -0,0 +1,217 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   schroederreverb.h
+ *         Implements a Schroeder/Freeverb style reverberator
+ * \author Pablo Alvarado
+ * \date   2011.10.09
+ *
+ * $Id: schroederreverb.h $
+ */
+
+#ifndef SCHROEDERREVERB_H
+#define SCHROEDERREVERB_H
+
+/**
+ * Schroeder/Freeverb style reverberator
+ *
+ * The input feeds 8 parallel lowpass-feedback comb filters, whose summed
+ * output passes through 4 allpass filters in series.  All delays are
+ * mutually prime, to avoid coinciding echoes.
+ *
+ * Each comb filter follows
+ * \f[
+ * l_i(n)=(1-d)y_i(n-k_i) + d\,l_i(n-1) \qquad
+ * y_i(n)=g x(n) + \alpha l_i(n)
+ * \f]
+ * with d the damping factor.
+ *
+ * The 8 comb lines share one ring buffer with interleaved samples: the
+ * 8 values written at time n are contiguous, so that all lines are updated
+ * with a single AVX register per sample (reading with one gather).  As in
+ * the simple reverb, the ring size is a power of two and the modulo is
+ * computed with a mask.
+ */
+class schroederReverb {
+public:
+  /**
+   * Constructor
+   */
+  schroederReverb();
+
+  /**
+   * Destructor
+   */
+  ~schroederReverb();
+
+  /**
+   * Init the filter operation
+   *
+   * @param sampleRate used sample rate
+   * @param delay delay of the longest comb filter in ms.  The other delays
+   *              are scaled accordingly.  This value must be less than
+   *              MaxDelay.
+   * @param alpha feedback factor of the comb filters (room size).  Must be
+   *              between 0 and 1.
+   */
+  void init(int sampleRate,
+            float delay,
+            float alpha);
+
+  /**
+   * Filter the in buffer and leave the result in out
+   */
+  void filter(int blockSize,
+              const float* in,
+              float* out);
+
+  /**
+   * Return alpha value in use.
+   */
+  float getAlpha() const;
+
+  /**
+   * Return delay value of the longest comb in use, in miliseconds.
+   */
+  float getDelay() const;
+
+  /**
+   * Set alpha value in use.
+   */
+  void setAlpha(float alpha);
+
+  /**
+   * Set delay value of the longest comb, in miliseconds.
+   */
+  void setDelay(float delay);
+
+  /**
+   * Set damping factor (between 0 and 1) of the comb lowpass filters
+   */
+  void setDamping(float damping);
+
+  /**
+   * Set the amount of reverberated signal in the output (between 0 and 1)
+   */
+  void setMix(float wet);
+
+  /**
+   * Reset reverberator
+   */
+  void reset();
+
+  /**
+   * Number of samples the output needs to decay below epsilon times the
+   * level of the last input, after the input becomes silent
+   */
+  int tailLength(float epsilon) const;
+
+  /**
+   * Constant that defines what is the maximum delay allowed in ms
+   */
+  static const float MaxDelay;
+
+  /**
+   * Some constants
+   */
+  enum {
+    Combs=8,
+    Allpasses=4
+  };
+
+protected:
+  /**
+   * Ring buffer of the comb filters, with the Combs lines interleaved.
+   *
+   * This will have a 2^n*Combs size to facilitate the modulo computation
+   */
+  float* combBuffer_;
+
+  /**
+   * Ring buffer size (in samples per line)
+   */
+  int combBufferSize_;
+
+  /**
+   * Index of the last processed data in the comb ring buffer
+   */
+  int combIdx_;
+
+  /**
+   * Delay of each comb line
+   */
+  int combDelay_[Combs];
+
+  /**
+   * State of the lowpass filter of each comb line
+   */
+  float lowpass_[Combs];
+
+  /**
+   * Ring buffers of the allpass filters
+   */
+  float* allpassBuffer_[Allpasses];
+
+  /**
+   * Ring buffer size of the allpass filters
+   */
+  int allpassBufferSize_;
+
+  /**
+   * Index of the last processed data in the allpass ring buffers
+   */
+  int allpassIdx_;
+
+  /**
+   * Delay of each allpass filter
+   */
+  int allpassDelay_[Allpasses];
+
+  /**
+   * Delay of the longest comb line in ms
+   */
+  float delay_;
+
+  /**
+   * Alpha coefficient (comb feedback)
+   */
+  float alpha_;
+
+  /**
+   * Damping of the comb lowpass filters
+   */
+  float damping_;
+
+  /**
+   * Wet amount in the output
+   */
+  float wet_;
+
+  /**
+   * Sample rate
+   */
+  int sampleRate_;
+
+  /**
+   * Smallest prime number larger or equal than n
+   */
+  static int nextPrime(int n);
+};
+
+#endif // SCHROEDERREVERB_H
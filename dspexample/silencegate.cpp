@@ -0,0 +1,76 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   silencegate.cpp
+ *         Detects when a processing stage has nothing left to do
+ * \author Pablo Alvarado
+ * \date   2011.10.02
+ *
+ * $Id: silencegate.cpp $
+ */
+
+#include "silencegate.h"
+#include "simd.h"
+
+const float silenceGate::SilenceLevel = 1.0e-8f;
+
+silenceGate::silenceGate() : silence_(0),idle_(false),entered_(false) {
+}
+
+/*
+ * Check the next input block of the stage
+ */
+bool silenceGate::idle(const float* in,int blockSize,int tail) {
+  entered_=false;
+
+  if (simd::energy(in,blockSize) > SilenceLevel*blockSize) {
+    // something to process
+    silence_=0;
+    idle_=false;
+    return false;
+  }
+
+  if (!idle_) {
+    if (silence_ < tail) {
+      // silent input, but the stage is still ringing
+      silence_+=blockSize;
+      return false;
+    }
+    idle_=true;
+    entered_=true;
+  }
+
+  return true;
+}
+
+/*
+ * Return true if the stage was just put to sleep
+ */
+bool silenceGate::entered() const {
+  return entered_;
+}
+
+/*
+ * Forget the silence counted so far
+ */
+void silenceGate::reset() {
+  silence_=0;
+  idle_=false;
+  entered_=false;
+}
@@ -0,0 +1,90 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   silencegate.h
+ *         Detects when a processing stage has nothing left to do
+ * \author Pablo Alvarado
+ * \date   2011.10.02
+ *
+ * $Id: silencegate.h $
+ */
+
+#ifndef SILENCEGATE_H
+#define SILENCEGATE_H
+
+/**
+ * Silence gate for one processing stage.
+ *
+ * The gate counts how many consecutive silent input samples the stage has
+ * received.  Once that count reaches the length of the stage tail (i.e. its
+ * output has decayed to negligible values) the stage can be skipped and its
+ * output replaced by zeros, until non-silent input arrives again.
+ */
+class silenceGate {
+public:
+  /**
+   * Constructor
+   */
+  silenceGate();
+
+  /**
+   * Check the next input block of the stage.
+   *
+   * @param in input block of the stage
+   * @param blockSize number of samples in the block
+   * @param tail remaining tail length of the stage, in samples
+   * @return true if the stage can be skipped for this block
+   */
+  bool idle(const float* in,int blockSize,int tail);
+
+  /**
+   * Return true if the last call to idle() was the first one returning true
+   * after some activity, i.e. the stage was just put to sleep.  The owner
+   * should reset the stage state at that point.
+   */
+  bool entered() const;
+
+  /**
+   * Forget the silence counted so far
+   */
+  void reset();
+
+  /**
+   * Mean square value below which a block is considered silent (-80dBFS)
+   */
+  static const float SilenceLevel;
+
+protected:
+  /**
+   * Number of consecutive silent samples received
+   */
+  int silence_;
+
+  /**
+   * The stage is sleeping
+   */
+  bool idle_;
+
+  /**
+   * The stage was just put to sleep
+   */
+  bool entered_;
+};
+
+#endif // SILENCEGATE_H
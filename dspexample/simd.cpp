@@ -0,0 +1,326 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   simd.cpp
+ *         Vectorized kernels shared by several processing stages
+ * \author Pablo Alvarado
+ * \date   2011.10.02
+ *
+ * $Id: simd.cpp $
+ */
+
+#include "simd.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+constexpr float simd::DenormalGuard;
+
+/*
+ * Sum of the squares of the n given samples
+ */
+float simd::energy(const float* x,const int n) {
+  int i=0;
+  float acc=0.0f;
+
+#ifdef __SSE__
+  // two independent accumulators to hide the latency of the additions
+  __m128 acc0=_mm_setzero_ps();
+  __m128 acc1=_mm_setzero_ps();
+  for (;i+8<=n;i+=8) {
+    const __m128 a=_mm_loadu_ps(x+i);
+    const __m128 b=_mm_loadu_ps(x+i+4);
+    acc0=_mm_add_ps(acc0,_mm_mul_ps(a,a));
+    acc1=_mm_add_ps(acc1,_mm_mul_ps(b,b));
+  }
+  float tmp[4];
+  _mm_storeu_ps(tmp,_mm_add_ps(acc0,acc1));
+  acc=(tmp[0]+tmp[1])+(tmp[2]+tmp[3]);
+#endif
+
+  for (;i<n;++i) {
+    acc+=x[i]*x[i];
+  }
+  return acc;
+}
+
+/*
+ * Scaled accumulation of n samples
+ */
+void simd::axpy(float* y,const float* x,const float a,const int n) {
+  int i=0;
+
+#ifdef __SSE__
+  const __m128 va=_mm_set1_ps(a);
+  for (;i+8<=n;i+=8) {
+    const __m128 x0=_mm_loadu_ps(x+i);
+    const __m128 x1=_mm_loadu_ps(x+i+4);
+    _mm_storeu_ps(y+i,_mm_add_ps(_mm_loadu_ps(y+i),_mm_mul_ps(va,x0)));
+    _mm_storeu_ps(y+i+4,_mm_add_ps(_mm_loadu_ps(y+i+4),_mm_mul_ps(va,x1)));
+  }
+#endif
+
+  for (;i<n;++i) {
+    y[i]+=a*x[i];
+  }
+}
+
+/*
+ * Scaled copy of n samples
+ */
+void simd::scale(float* y,const float* x,const float a,const int n) {
+  int i=0;
+
+#ifdef __SSE__
+  const __m128 va=_mm_set1_ps(a);
+  for (;i+8<=n;i+=8) {
+    _mm_storeu_ps(y+i,_mm_mul_ps(va,_mm_loadu_ps(x+i)));
+    _mm_storeu_ps(y+i+4,_mm_mul_ps(va,_mm_loadu_ps(x+i+4)));
+  }
+#endif
+
+  for (;i<n;++i) {
+    y[i]=a*x[i];
+  }
+}
+
+/*
+ * Replace the non-finite samples by zero
+ */
+int simd::sanitize(float* x,const int n) {
+  int i=0;
+  int bad=0;
+
+#ifdef __SSE__
+  // x*0 is zero for finite values and NaN otherwise
+  const __m128 zero=_mm_setzero_ps();
+  for (;i+4<=n;i+=4) {
+    const __m128 v=_mm_loadu_ps(x+i);
+    const __m128 z=_mm_mul_ps(v,zero);
+    const __m128 nan=_mm_cmpunord_ps(z,z);
+    const int m=_mm_movemask_ps(nan);
+    if (m!=0) {
+      // rare: count the lanes and clear them
+      bad+=((m>>0)&1)+((m>>1)&1)+((m>>2)&1)+((m>>3)&1);
+      _mm_storeu_ps(x+i,_mm_andnot_ps(nan,v));
+    }
+  }
+#endif
+
+  for (;i<n;++i) {
+    const float z=x[i]*0.0f;
+    if (z!=z) {
+      x[i]=0.0f;
+      ++bad;
+    }
+  }
+  return bad;
+}
+
+/*
+ * Conversion of n samples to half precision
+ */
+void simd::toHalf(const float* x,uint16_t* h,const int n) {
+  int i=0;
+#ifdef __F16C__
+  for (;i+8<=n;i+=8) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(h+i),
+                     _mm256_cvtps_ph(_mm256_loadu_ps(x+i),0));
+  }
+#endif
+  for (;i<n;++i) {
+    h[i]=toHalf(x[i]);
+  }
+}
+
+/*
+ * Conversion of n samples from half precision
+ */
+void simd::fromHalf(const uint16_t* h,float* x,const int n) {
+  int i=0;
+#ifdef __F16C__
+  for (;i+8<=n;i+=8) {
+    _mm256_storeu_ps(x+i,_mm256_cvtph_ps(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(h+i))));
+  }
+#endif
+  for (;i<n;++i) {
+    x[i]=fromHalf(h[i]);
+  }
+}
+
+/*
+ * Flush-to-zero (bit 15) and denormals-are-zero (bit 6) of the MXCSR
+ */
+void simd::disableDenormals() {
+#ifdef __SSE__
+  _mm_setcsr(_mm_getcsr() | 0x8040);
+#endif
+}
+
+/*
+ * Conversion of n 16 bit samples
+ */
+void simd::toFloat(const int16_t* in,float* out,const int n) {
+  const float scale=1.0f/32768.0f;
+  int i=0;
+#ifdef __SSE2__
+  const __m128 vs=_mm_set1_ps(scale);
+  for (;i+8<=n;i+=8) {
+    const __m128i v=_mm_loadu_si128(reinterpret_cast<const __m128i*>(in+i));
+    // the samples land in the upper half of each lane, and the arithmetic
+    // shift extends their sign
+    const __m128i lo=_mm_srai_epi32(_mm_unpacklo_epi16(v,v),16);
+    const __m128i hi=_mm_srai_epi32(_mm_unpackhi_epi16(v,v),16);
+    _mm_storeu_ps(out+i,_mm_mul_ps(_mm_cvtepi32_ps(lo),vs));
+    _mm_storeu_ps(out+i+4,_mm_mul_ps(_mm_cvtepi32_ps(hi),vs));
+  }
+#endif
+  for (;i<n;++i) {
+    out[i]=float(in[i])*scale;
+  }
+}
+
+/*
+ * Conversion of n 32 bit samples
+ */
+void simd::toFloat(const int32_t* in,float* out,const int n) {
+  const float scale=1.0f/2147483648.0f;
+  int i=0;
+#ifdef __SSE2__
+  const __m128 vs=_mm_set1_ps(scale);
+  for (;i+8<=n;i+=8) {
+    const __m128i a=_mm_loadu_si128(reinterpret_cast<const __m128i*>(in+i));
+    const __m128i b=_mm_loadu_si128(reinterpret_cast<const __m128i*>(in+i+4));
+    _mm_storeu_ps(out+i,_mm_mul_ps(_mm_cvtepi32_ps(a),vs));
+    _mm_storeu_ps(out+i+4,_mm_mul_ps(_mm_cvtepi32_ps(b),vs));
+  }
+#endif
+  for (;i<n;++i) {
+    out[i]=float(in[i])*scale;
+  }
+}
+
+/*
+ * Conversion of n packed 24 bit samples.  Each sample is moved to the upper
+ * three bytes of a 32 bit lane, so that the sign comes for free.
+ */
+void simd::int24ToFloat(const unsigned char* in,float* out,const int n) {
+  const float scale=1.0f/2147483648.0f;
+  int i=0;
+#ifdef __SSSE3__
+  const __m128 vs=_mm_set1_ps(scale);
+  const __m128i spread=_mm_setr_epi8(-1,0,1,2,-1,3,4,5,
+                                     -1,6,7,8,-1,9,10,11);
+  // each load takes 16 bytes but only consumes 12: stop two samples early
+  for (;i+6<=n;i+=4) {
+    const __m128i v=
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(in+3*i));
+    const __m128i s=_mm_shuffle_epi8(v,spread);
+    _mm_storeu_ps(out+i,_mm_mul_ps(_mm_cvtepi32_ps(s),vs));
+  }
+#endif
+  for (;i<n;++i) {
+    const unsigned char* p=in+3*i;
+    const int32_t v=static_cast<int32_t>((uint32_t(p[0])<<8) |
+                                         (uint32_t(p[1])<<16) |
+                                         (uint32_t(p[2])<<24));
+    out[i]=float(v)*scale;
+  }
+}
+
+/*
+ * Average of the channels of each interleaved frame
+ */
+void simd::downmix(const float* in,float* out,
+                   const int frames,const int channels) {
+  int f=0;
+
+  switch(channels) {
+  case 1:
+    memcpy(out,in,frames*sizeof(float));
+    return;
+  case 2: {
+#ifdef __SSE__
+    const __m128 half=_mm_set1_ps(0.5f);
+    for (;f+4<=frames;f+=4) {
+      const __m128 a=_mm_loadu_ps(in+2*f);
+      const __m128 b=_mm_loadu_ps(in+2*f+4);
+      const __m128 l=_mm_shuffle_ps(a,b,_MM_SHUFFLE(2,0,2,0));
+      const __m128 r=_mm_shuffle_ps(a,b,_MM_SHUFFLE(3,1,3,1));
+      _mm_storeu_ps(out+f,_mm_mul_ps(_mm_add_ps(l,r),half));
+    }
+#endif
+    for (;f<frames;++f) {
+      out[f]=(in[2*f]+in[2*f+1])*0.5f;
+    }
+    return;
+  }
+#ifdef __SSE3__
+  case 6: {
+    // two frames span three registers: the middle one is split between
+    // them.  The horizontal additions then reduce four frames at once.
+    const __m128 scale=_mm_set1_ps(1.0f/6.0f);
+    const __m128 zero=_mm_setzero_ps();
+    for (;f+4<=frames;f+=4) {
+      const float* p=in+6*f;
+      __m128 s[4];
+      for (int k=0;k<2;++k,p+=12) {
+        const __m128 v0=_mm_loadu_ps(p);
+        const __m128 v1=_mm_loadu_ps(p+4);
+        const __m128 v2=_mm_loadu_ps(p+8);
+        s[2*k]  =_mm_add_ps(v0,_mm_movelh_ps(v1,zero));
+        s[2*k+1]=_mm_add_ps(v2,_mm_movehl_ps(zero,v1));
+      }
+      const __m128 sum=_mm_hadd_ps(_mm_hadd_ps(s[0],s[1]),
+                                   _mm_hadd_ps(s[2],s[3]));
+      _mm_storeu_ps(out+f,_mm_mul_ps(sum,scale));
+    }
+    break;
+  }
+  case 8: {
+    const __m128 scale=_mm_set1_ps(1.0f/8.0f);
+    for (;f+4<=frames;f+=4) {
+      const float* p=in+8*f;
+      const __m128 s0=_mm_add_ps(_mm_loadu_ps(p),_mm_loadu_ps(p+4));
+      const __m128 s1=_mm_add_ps(_mm_loadu_ps(p+8),_mm_loadu_ps(p+12));
+      const __m128 s2=_mm_add_ps(_mm_loadu_ps(p+16),_mm_loadu_ps(p+20));
+      const __m128 s3=_mm_add_ps(_mm_loadu_ps(p+24),_mm_loadu_ps(p+28));
+      const __m128 sum=_mm_hadd_ps(_mm_hadd_ps(s0,s1),_mm_hadd_ps(s2,s3));
+      _mm_storeu_ps(out+f,_mm_mul_ps(sum,scale));
+    }
+    break;
+  }
+#endif
+  default:
+    break;
+  }
+
+  // generic layouts, and the tails of the specialized ones
+  const float scale=1.0f/float(channels);
+  for (;f<frames;++f) {
+    const float* p=in+f*channels;
+    float acc=0.0f;
+    for (int c=0;c<channels;++c) {
+      acc+=p[c];
+    }
+    out[f]=acc*scale;
+  }
+}
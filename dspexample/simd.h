@@ -0,0 +1,268 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   simd.h
+ *         Vectorized kernels shared by several processing stages
+ * \author Pablo Alvarado
+ * \date   2011.10.02
+ *
+ * $Id: simd.h $
+ */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __SSE3__
+#include <pmmintrin.h>
+#endif
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+#if defined(__AVX__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Collection of small block kernels.
+ *
+ * Each kernel has an SSE implementation and a plain C++ fallback, selected
+ * at compile time.
+ */
+class simd {
+public:
+  /**
+   * Sum of the squares of the n given samples
+   */
+  static float energy(const float* x,const int n);
+
+  /**
+   * Scaled accumulation y(i) += a*x(i) of n samples
+   */
+  static void axpy(float* y,const float* x,const float a,const int n);
+
+  /**
+   * Scaled copy y(i) = a*x(i) of n samples
+   */
+  static void scale(float* y,const float* x,const float a,const int n);
+
+  /**
+   * Replace the non-finite samples (NaN and infinities) by zero.
+   *
+   * @return number of samples replaced
+   */
+  static int sanitize(float* x,const int n);
+
+  /**
+   * Set the flush-to-zero and denormals-are-zero modes of the calling
+   * thread, so that subnormal results and operands are replaced by zero.
+   *
+   * It must be called at the start of every thread running the processing
+   * stages.
+   */
+  static void disableDenormals();
+
+  /**
+   * @name Sample format conversion
+   *
+   * Decoding of the sample formats found in audio files, so that sources
+   * can be read in their native format.  The integer conversions scale the
+   * full range to [-1,1), and the downmix averages the channels of
+   * interleaved frames into one mono sample per frame.  The downmix has
+   * specialized kernels for 1, 2, 6 and 8 channels, and a generic loop for
+   * all other layouts.
+   */
+  //{
+  static void toFloat(const int16_t* in,float* out,const int n);
+  static void toFloat(const int32_t* in,float* out,const int n);
+
+  /**
+   * Conversion of n packed 24 bit little endian samples (3 bytes each)
+   */
+  static void int24ToFloat(const unsigned char* in,float* out,const int n);
+
+  static void downmix(const float* in,float* out,
+                      const int frames,const int channels);
+  //}
+
+  /**
+   * @name Flush of subnormal values in recursive filters
+   *
+   * Adding and subtracting a tiny constant sets to zero any value much
+   * smaller than it, while leaving normal signal values unchanged.  This
+   * keeps the state of feedback loops free of subnormals even on threads
+   * or platforms without flush-to-zero mode.  (It relies on the compiler
+   * not reassociating floating point operations, i.e. no -ffast-math.)
+   */
+  //{
+  static inline float flushDenormal(const float x) {
+    return (x+DenormalGuard)-DenormalGuard;
+  }
+
+#ifdef __SSE__
+  static inline __m128 flushDenormal(const __m128 x) {
+    const __m128 g=_mm_set1_ps(DenormalGuard);
+    return _mm_sub_ps(_mm_add_ps(x,g),g);
+  }
+#endif
+
+#ifdef __AVX__
+  static inline __m256 flushDenormal(const __m256 x) {
+    const __m256 g=_mm256_set1_ps(DenormalGuard);
+    return _mm256_sub_ps(_mm256_add_ps(x,g),g);
+  }
+#endif
+  //}
+
+  /**
+   * @name Half precision storage
+   *
+   * Large state (delay lines, filter spectra) can be stored as IEEE 754
+   * binary16 values, halving its footprint and memory traffic, while all
+   * arithmetic is still done in single precision.  The conversions use the
+   * F16C instructions if available, and a software rounding to nearest
+   * even otherwise.  The load() and store() overloads let the same kernel
+   * template work on float and on half precision storage.
+   */
+  //{
+  static void toHalf(const float* x,uint16_t* h,const int n);
+  static void fromHalf(const uint16_t* h,float* x,const int n);
+
+  static inline uint16_t toHalf(const float x) {
+#ifdef __F16C__
+    return _cvtss_sh(x,0);
+#else
+    uint32_t b;
+    memcpy(&b,&x,sizeof(b));
+    const uint16_t sign=(b>>16) & 0x8000;
+    b&=0x7fffffff;
+    if (b>=0x7f800000) { // inf and nan
+      return sign | 0x7c00 | ((b>0x7f800000) ? 0x0200 : 0);
+    }
+    if (b>=0x477ff000) { // overflow
+      return sign | 0x7c00;
+    }
+    if (b<0x38800000) { // subnormal half
+      if (b<0x33000000) {
+        return sign;
+      }
+      const int shift=126-(b>>23);
+      const uint32_t m=(b & 0x7fffff) | 0x800000;
+      uint32_t h=m>>shift;
+      const uint32_t rem=m & ((1u<<shift)-1);
+      const uint32_t half=1u<<(shift-1);
+      if ((rem>half) || ((rem==half) && (h&1))) {
+        ++h;
+      }
+      return sign | h;
+    }
+    uint32_t h=(b-0x38000000)>>13;
+    const uint32_t rem=b & 0x1fff;
+    if ((rem>0x1000) || ((rem==0x1000) && (h&1))) {
+      ++h;
+    }
+    return sign | h;
+#endif
+  }
+
+  static inline float fromHalf(const uint16_t h) {
+#ifdef __F16C__
+    return _cvtsh_ss(h);
+#else
+    const uint32_t sign=uint32_t(h & 0x8000)<<16;
+    const uint32_t e=(h>>10) & 0x1f;
+    const uint32_t m=h & 0x3ff;
+    uint32_t b;
+    if (e==0) {
+      const float v=float(m)*(1.0f/16777216.0f); // m*2^-24
+      return sign ? -v : v;
+    } else if (e==31) {
+      b=sign | 0x7f800000 | (m<<13);
+    } else {
+      b=sign | ((e+112)<<23) | (m<<13);
+    }
+    float x;
+    memcpy(&x,&b,sizeof(x));
+    return x;
+#endif
+  }
+
+  static inline float load(const float* p) {
+    return *p;
+  }
+  static inline float load(const uint16_t* p) {
+    return fromHalf(*p);
+  }
+  static inline void store(float* p,const float x) {
+    *p=x;
+  }
+  static inline void store(uint16_t* p,const float x) {
+    *p=toHalf(x);
+  }
+
+#ifdef __SSE__
+  static inline __m128 load4(const float* p) {
+    return _mm_loadu_ps(p);
+  }
+  static inline void store4(float* p,const __m128 x) {
+    _mm_storeu_ps(p,x);
+  }
+
+  static inline __m128 load4(const uint16_t* p) {
+#ifdef __F16C__
+    return _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+#else
+    return _mm_setr_ps(fromHalf(p[0]),fromHalf(p[1]),
+                       fromHalf(p[2]),fromHalf(p[3]));
+#endif
+  }
+  static inline void store4(uint16_t* p,const __m128 x) {
+#ifdef __F16C__
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(p),_mm_cvtps_ph(x,0));
+#else
+    float tmp[4];
+    _mm_storeu_ps(tmp,x);
+    p[0]=toHalf(tmp[0]);
+    p[1]=toHalf(tmp[1]);
+    p[2]=toHalf(tmp[2]);
+    p[3]=toHalf(tmp[3]);
+#endif
+  }
+#endif
+  //}
+
+  /**
+   * Constant used to flush subnormals (about -360dB)
+   */
+  static constexpr float DenormalGuard = 1.0e-18f;
+};
+
+#endif // SIMD_H
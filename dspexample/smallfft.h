@@ -0,0 +1,359 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   smallfft.h
+ *         Compile-time specialized real FFTs for small block sizes
+ * \author Pablo Alvarado
+ * \date   2011.10.02
+ *
+ * $Id: smallfft.h $
+ */
+
+#ifndef SMALLFFT_H
+#define SMALLFFT_H
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+/**
+ * Helper functions evaluated at compile time to build the twiddle tables.
+ *
+ * The standard sin() and cos() are not constexpr, so a Taylor series is
+ * used instead.  All arguments used here lie in [-pi,pi], where 24 terms
+ * are more than enough for double precision.
+ */
+class smallFFTMath {
+public:
+  static constexpr double Pi = 3.14159265358979323846;
+
+  static constexpr double sin(const double x) {
+    double term=x;
+    double sum=x;
+    for (int i=1;i<24;++i) {
+      term *= -x*x/double((2*i)*(2*i+1));
+      sum += term;
+    }
+    return sum;
+  }
+
+  static constexpr double cos(const double x) {
+    double term=1.0;
+    double sum=1.0;
+    for (int i=1;i<24;++i) {
+      term *= -x*x/double((2*i-1)*(2*i));
+      sum += term;
+    }
+    return sum;
+  }
+};
+
+/**
+ * Real FFT of fixed size N
+ *
+ * The transform of N real samples is computed with a complex FFT of N/2
+ * points (even samples in the real part, odd samples in the imaginary part)
+ * followed by the usual split step.  The complex FFT is an iterative
+ * radix-2 decimation in time, working on separate real and imaginary arrays
+ * so that the butterflies of each stage can be computed four at a time with
+ * SSE.
+ *
+ * All twiddle factors and the bit-reversal permutation are computed by the
+ * compiler, so that no plan has to be created nor dispatched at run time.
+ *
+ * The results are identical in layout and scaling to the ones of
+ * fftwf_plan_guru_split_dft_r2c() and fftwf_plan_guru_split_dft_c2r(),
+ * i.e. N/2+1 complex values are produced/consumed as separate real and
+ * imaginary arrays and the inverse transform is not normalized.  Unlike
+ * FFTW's c2r, the inverse does not destroy its input.
+ *
+ * Both transforms copy their input to local arrays before writing any
+ * output, so they can be used in place (x==Xr) as well.
+ */
+template<int N>
+class smallFFT {
+public:
+  enum {
+    Size=N,
+    Half=N/2
+  };
+
+  /**
+   * Forward transform of N real samples into N/2+1 complex values
+   */
+  static void forward(const float* x,float* Xr,float* Xi);
+
+  /**
+   * Inverse transform of N/2+1 complex values into N real samples
+   */
+  static void inverse(const float* Xr,const float* Xi,float* x);
+
+private:
+  /**
+   * Twiddle factors and permutation indices
+   */
+  struct tables {
+    /**
+     * Twiddles of the complex FFT.  Stage with half-size h uses the entries
+     * [h,2h), i.e. w[h+j] = exp(-i pi j/h)
+     */
+    float wr[Half];
+    float wi[Half];
+
+    /**
+     * Twiddles of the split step: exp(-i 2 pi k/N)
+     */
+    float sr[Half];
+    float si[Half];
+
+    /**
+     * Bit reversal permutation of Half elements
+     */
+    int rev[Half];
+
+    constexpr tables() : wr(),wi(),sr(),si(),rev() {
+      for (int h=1;h<Half;h*=2) {
+        for (int j=0;j<h;++j) {
+          wr[h+j] = float(smallFFTMath::cos(-smallFFTMath::Pi*j/h));
+          wi[h+j] = float(smallFFTMath::sin(-smallFFTMath::Pi*j/h));
+        }
+      }
+      for (int k=0;k<Half;++k) {
+        sr[k] = float(smallFFTMath::cos(-2.0*smallFFTMath::Pi*k/N));
+        si[k] = float(smallFFTMath::sin(-2.0*smallFFTMath::Pi*k/N));
+      }
+      int bits=0;
+      while ((1<<bits)<Half) {
+        ++bits;
+      }
+      for (int k=0;k<Half;++k) {
+        int r=0;
+        for (int b=0;b<bits;++b) {
+          r |= ((k>>b)&1) << (bits-1-b);
+        }
+        rev[k]=r;
+      }
+    }
+  };
+
+  static constexpr tables tab_ = tables();
+
+  /**
+   * In-place complex FFT of Half points, with bit-reversed input.
+   * If Inverse is true, the conjugated twiddles are used.
+   */
+  template<bool Inverse>
+  static void fft(float* re,float* im);
+};
+
+template<int N>
+constexpr typename smallFFT<N>::tables smallFFT<N>::tab_;
+
+template<int N>
+template<bool Inverse>
+inline void smallFFT<N>::fft(float* re,float* im) {
+  const float sgn = Inverse ? -1.0f : 1.0f;
+
+  // the first two stages have trivial twiddles and too few butterflies
+  // per group to be worth vectorizing
+  for (int h=1;(h<Half) && (h<4);h*=2) {
+    for (int g=0;g<Half;g+=2*h) {
+      for (int j=0;j<h;++j) {
+        const int a=g+j;
+        const int b=a+h;
+        const float wr=tab_.wr[h+j];
+        const float wi=sgn*tab_.wi[h+j];
+        const float tr=wr*re[b]-wi*im[b];
+        const float ti=wr*im[b]+wi*re[b];
+        re[b]=re[a]-tr;
+        im[b]=im[a]-ti;
+        re[a]+=tr;
+        im[a]+=ti;
+      }
+    }
+  }
+
+  for (int h=4;h<Half;h*=2) {
+    for (int g=0;g<Half;g+=2*h) {
+      float* ra=re+g;
+      float* ia=im+g;
+      float* rb=ra+h;
+      float* ib=ia+h;
+      const float* wrp=tab_.wr+h;
+      const float* wip=tab_.wi+h;
+#ifdef __SSE__
+      const __m128 vs=_mm_set1_ps(sgn);
+      for (int j=0;j<h;j+=4) {
+        const __m128 wr=_mm_loadu_ps(wrp+j);
+        const __m128 wi=_mm_mul_ps(vs,_mm_loadu_ps(wip+j));
+        const __m128 br=_mm_loadu_ps(rb+j);
+        const __m128 bi=_mm_loadu_ps(ib+j);
+        const __m128 ar=_mm_loadu_ps(ra+j);
+        const __m128 ai=_mm_loadu_ps(ia+j);
+        const __m128 tr=_mm_sub_ps(_mm_mul_ps(wr,br),_mm_mul_ps(wi,bi));
+        const __m128 ti=_mm_add_ps(_mm_mul_ps(wr,bi),_mm_mul_ps(wi,br));
+        _mm_storeu_ps(rb+j,_mm_sub_ps(ar,tr));
+        _mm_storeu_ps(ib+j,_mm_sub_ps(ai,ti));
+        _mm_storeu_ps(ra+j,_mm_add_ps(ar,tr));
+        _mm_storeu_ps(ia+j,_mm_add_ps(ai,ti));
+      }
+#else
+      for (int j=0;j<h;++j) {
+        const float wr=wrp[j];
+        const float wi=sgn*wip[j];
+        const float tr=wr*rb[j]-wi*ib[j];
+        const float ti=wr*ib[j]+wi*rb[j];
+        rb[j]=ra[j]-tr;
+        ib[j]=ia[j]-ti;
+        ra[j]+=tr;
+        ia[j]+=ti;
+      }
+#endif
+    }
+  }
+}
+
+template<int N>
+inline void smallFFT<N>::forward(const float* x,float* Xr,float* Xi) {
+#ifdef __SSE__
+  __attribute__((aligned(16))) float re[Half];
+  __attribute__((aligned(16))) float im[Half];
+#else
+  float re[Half];
+  float im[Half];
+#endif
+
+  // pack even samples as real part, odd samples as imaginary part
+  for (int n=0;n<Half;++n) {
+    const int r=tab_.rev[n];
+    re[r]=x[2*n];
+    im[r]=x[2*n+1];
+  }
+
+  fft<false>(re,im);
+
+  // split step: X(k) = E(k) + W^k O(k)
+  Xr[0]=re[0]+im[0];
+  Xi[0]=0.0f;
+  Xr[Half]=re[0]-im[0];
+  Xi[Half]=0.0f;
+
+  for (int k=1;k<Half;++k) {
+    const int c=Half-k;
+    const float er=0.5f*(re[k]+re[c]);
+    const float ei=0.5f*(im[k]-im[c]);
+    const float or_=0.5f*(im[k]+im[c]);
+    const float oi=-0.5f*(re[k]-re[c]);
+    const float wr=tab_.sr[k];
+    const float wi=tab_.si[k];
+    Xr[k]=er+wr*or_-wi*oi;
+    Xi[k]=ei+wr*oi+wi*or_;
+  }
+}
+
+template<int N>
+inline void smallFFT<N>::inverse(const float* Xr,const float* Xi,float* x) {
+#ifdef __SSE__
+  __attribute__((aligned(16))) float re[Half];
+  __attribute__((aligned(16))) float im[Half];
+#else
+  float re[Half];
+  float im[Half];
+#endif
+
+  // undo the split step, leaving the result in bit reversed order.
+  // As in FFTW, the imaginary parts of X(0) and X(N/2) are ignored.
+  const float a=Xr[0];
+  const float b=Xr[Half];
+  re[0]=a+b;
+  im[0]=a-b;
+
+  for (int k=1;k<Half;++k) {
+    const int c=Half-k;
+    const int r=tab_.rev[k];
+    const float er=Xr[k]+Xr[c];
+    const float ei=Xi[k]-Xi[c];
+    const float dr=Xr[k]-Xr[c];
+    const float di=Xi[k]+Xi[c];
+    const float wr=tab_.sr[k];
+    const float wi=-tab_.si[k];
+    const float or_=wr*dr-wi*di;
+    const float oi=wr*di+wi*dr;
+    re[r]=er-oi;
+    im[r]=ei+or_;
+  }
+
+  fft<true>(re,im);
+
+  for (int n=0;n<Half;++n) {
+    x[2*n]=re[n];
+    x[2*n+1]=im[n];
+  }
+}
+
+/**
+ * Selection of the compile-time specialized transforms
+ */
+class smallFFTSelector {
+public:
+  typedef void (*forwardFn)(const float*,float*,float*);
+  typedef void (*inverseFn)(const float*,const float*,float*);
+
+  enum {
+    MinSize=32,
+    MaxSize=512
+  };
+
+  /**
+   * Get the kernels for the given transform size.
+   *
+   * Returns false (and null pointers) if there is no specialization for that
+   * size, in which case FFTW has to be used.
+   */
+  static bool select(const int size,forwardFn& fwd,inverseFn& inv) {
+    switch(size) {
+    case 32:
+      fwd=&smallFFT<32>::forward;
+      inv=&smallFFT<32>::inverse;
+      return true;
+    case 64:
+      fwd=&smallFFT<64>::forward;
+      inv=&smallFFT<64>::inverse;
+      return true;
+    case 128:
+      fwd=&smallFFT<128>::forward;
+      inv=&smallFFT<128>::inverse;
+      return true;
+    case 256:
+      fwd=&smallFFT<256>::forward;
+      inv=&smallFFT<256>::inverse;
+      return true;
+    case 512:
+      fwd=&smallFFT<512>::forward;
+      inv=&smallFFT<512>::inverse;
+      return true;
+    default:
+      fwd=0;
+      inv=0;
+    }
+    return false;
+  }
+};
+
+#endif // SMALLFFT_H
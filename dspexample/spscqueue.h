@@ -0,0 +1,109 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file   spscqueue.h
+ *         Lock-free single producer, single consumer queue
+ * \author Pablo Alvarado
+ * \date   2011.10.18
+ *
+ * $Id: spscqueue.h $
+ */
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+
+/**
+ * Lock-free queue between exactly one producer and one consumer thread.
+ *
+ * It is used to pass data out of (or into) the real-time thread: neither
+ * side ever blocks nor allocates memory.  If the queue is full, push()
+ * fails and the element is dropped.
+ *
+ * Each index is written by one side only.  The release store of an index
+ * publishes the elements written before it to the other side.
+ *
+ * @param T type of the elements.  Must be copyable.
+ * @param N capacity.  Must be a power of two.
+ */
+template<typename T,int N>
+class spscQueue {
+public:
+  spscQueue() : head_(0),tail_(0) {
+    static_assert((N>0) && ((N&(N-1))==0),"capacity must be a power of two");
+  }
+
+  /**
+   * Append one element (producer side)
+   *
+   * @return false if the queue is full
+   */
+  bool push(const T& value) {
+    const unsigned int t=tail_.load(std::memory_order_relaxed);
+    if (t-head_.load(std::memory_order_acquire) >= unsigned(N)) {
+      return false;
+    }
+    buffer_[t & (N-1)]=value;
+    tail_.store(t+1,std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Take the oldest element (consumer side)
+   *
+   * @return false if the queue is empty
+   */
+  bool pop(T& value) {
+    const unsigned int h=head_.load(std::memory_order_relaxed);
+    if (h==tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value=buffer_[h & (N-1)];
+    head_.store(h+1,std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Number of elements in the queue.  Only exact when called from one of
+   * both sides while the other one is idle.
+   */
+  int size() const {
+    return int(tail_.load(std::memory_order_acquire)-
+               head_.load(std::memory_order_acquire));
+  }
+
+protected:
+  /**
+   * Elements
+   */
+  T buffer_[N];
+
+  /**
+   * Number of elements taken so far (written by the consumer only)
+   */
+  std::atomic<unsigned int> head_;
+
+  /**
+   * Number of elements appended so far (written by the producer only)
+   */
+  std::atomic<unsigned int> tail_;
+};
+
+#endif // SPSCQUEUE_H
@@ -0,0 +1,567 @@
+/*
+ * DSP Example is part of the DSP Lecture at TEC-Costa Rica
+ * Copyright (C) 2010  Pablo Alvarado
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * \file   timing.cpp
+ *         Standalone timing of the processing kernels
+ * \author Pablo Alvarado
+ * \date   2011.10.26
+ *
+ * Build it apart from the application:
+ *
+ *   cd timing && qmake && make && ./timing
+ *
+ * $Id: timing.cpp $
+ */
+
+#include "simd.h"
+#include "combfilter.h"
+#include "freqFilter.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Seconds since the given time point
+ */
+static double since(const std::chrono::steady_clock::time_point& t0) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).
+    count();
+}
+
+/**
+ * Keeps the compiler from dropping the timed loops
+ */
+static volatile float sink;
+
+/*
+ * Complex product of the spectra, as freqFilter did it with interleaved
+ * fftwf_complex bins
+ */
+static void mulInterleaved(float* X,const float* H,const int bins) {
+  for (int n=0;n<2*bins;n+=2) {
+    const float re=X[n]*H[n]-X[n+1]*H[n+1];
+    const float im=X[n]*H[n+1]+X[n+1]*H[n];
+    X[n]=re;
+    X[n+1]=im;
+  }
+}
+
+#ifdef __SSE3__
+/*
+ * Interleaved complex product with SSE3, two bins per step.  The real and
+ * imaginary parts have to be shuffled into place.
+ */
+static void mulInterleavedSSE3(float* X,const float* H,const int bins) {
+  int n=0;
+  for (;n+4<=2*bins;n+=4) {
+    const __m128 x=_mm_loadu_ps(X+n);
+    const __m128 h=_mm_loadu_ps(H+n);
+    const __m128 hr=_mm_moveldup_ps(h);
+    const __m128 hi=_mm_movehdup_ps(h);
+    const __m128 xs=_mm_shuffle_ps(x,x,_MM_SHUFFLE(2,3,0,1));
+    _mm_storeu_ps(X+n,_mm_addsub_ps(_mm_mul_ps(x,hr),_mm_mul_ps(xs,hi)));
+  }
+  mulInterleaved(X+n,H+n,bins-n/2);
+}
+#endif
+
+/*
+ * Complex product with split real and imaginary arrays, as freqFilter
+ * does it now
+ */
+static void mulSplit(float* XRe,float* XIm,
+                     const float* HRe,const float* HIm,const int bins) {
+  int n=0;
+#ifdef __SSE__
+  for (;n+4<=bins;n+=4) {
+    const __m128 xr=_mm_loadu_ps(XRe+n);
+    const __m128 xi=_mm_loadu_ps(XIm+n);
+    const __m128 hr=_mm_loadu_ps(HRe+n);
+    const __m128 hi=_mm_loadu_ps(HIm+n);
+    _mm_storeu_ps(XRe+n,_mm_sub_ps(_mm_mul_ps(xr,hr),_mm_mul_ps(xi,hi)));
+    _mm_storeu_ps(XIm+n,_mm_add_ps(_mm_mul_ps(xr,hi),_mm_mul_ps(xi,hr)));
+  }
+#endif
+  for (;n<bins;++n) {
+    const float re=XRe[n]*HRe[n]-XIm[n]*HIm[n];
+    const float im=XRe[n]*HIm[n]+XIm[n]*HRe[n];
+    XRe[n]=re;
+    XIm[n]=im;
+  }
+}
+
+/**
+ * Nanoseconds per bin of the interleaved and split complex products, for
+ * the spectrum sizes used by freqFilter
+ */
+static void splitVsInterleaved() {
+  printf("Complex product of the spectra (ns per bin)\n");
+  printf("%8s %12s %12s %12s\n","HwSize","interleaved","sse3","split");
+
+  for (int HwSize=256;HwSize<=16384;HwSize*=2) {
+    const int bins=HwSize/2+1;
+    const int reps=(1<<26)/HwSize;
+
+    // the products are unit magnitude, so that repeating them stays finite
+    std::vector<float> X(2*bins),H(2*bins),XRe(bins),XIm(bins),
+      HRe(bins),HIm(bins);
+    for (int k=0;k<bins;++k) {
+      const float a=6.2831853f*rand()/RAND_MAX;
+      X[2*k]=XRe[k]=1.0f;
+      X[2*k+1]=XIm[k]=0.0f;
+      H[2*k]=HRe[k]=std::cos(a);
+      H[2*k+1]=HIm[k]=std::sin(a);
+    }
+
+    std::chrono::steady_clock::time_point t0=std::chrono::steady_clock::now();
+    for (int r=0;r<reps;++r) {
+      mulInterleaved(X.data(),H.data(),bins);
+    }
+    const double tInter=since(t0);
+    sink=X[0];
+
+    double tSSE3=0.0;
+#ifdef __SSE3__
+    t0=std::chrono::steady_clock::now();
+    for (int r=0;r<reps;++r) {
+      mulInterleavedSSE3(X.data(),H.data(),bins);
+    }
+    tSSE3=since(t0);
+    sink=X[0];
+#endif
+
+    t0=std::chrono::steady_clock::now();
+    for (int r=0;r<reps;++r) {
+      mulSplit(XRe.data(),XIm.data(),HRe.data(),HIm.data(),bins);
+    }
+    const double tSplit=since(t0);
+    sink=XRe[0];
+
+    const double scale=1.0e9/(double(reps)*bins);
+    printf("%8d %12.3f %12.3f %12.3f\n",
+           HwSize,tInter*scale,tSSE3*scale,tSplit*scale);
+  }
+  printf("\n");
+}
+
+/**
+ * Feedback comb y(n) = x(n) + g*y(n-Delay), as in the reverberators.  With
+ * g close to one the product of a subnormal state rounds back to itself,
+ * so without flushing the tail stays subnormal forever.
+ */
+class feedbackLoop {
+public:
+  enum {
+    Delay=64 /**< Delay of the feedback path, in samples */
+  };
+
+  feedbackLoop(const bool guard) : guard_(guard),idx_(0) {
+    memset(state_,0,sizeof(state_));
+  }
+
+  void filter(const float* in,float* out,const int n) {
+    for (int i=0;i<n;++i) {
+      float y=in[i]+0.999f*state_[idx_];
+      if (guard_) {
+        y=simd::flushDenormal(y);
+      }
+      state_[idx_]=y;
+      idx_=(idx_+1)%Delay;
+      out[i]=y;
+    }
+  }
+
+protected:
+  bool guard_;
+  int idx_;
+  float state_[Delay];
+};
+
+/**
+ * Block size of the tail measurements
+ */
+static const int TailBlock=1024;
+
+/**
+ * Feed one second of noise into the filter f and then silence, and return
+ * the ns per sample of the first and the last 100 silent blocks
+ */
+template<class F>
+static void tailCost(F& f,const int silentBlocks,double& early,double& late) {
+  const int Blocks=100;
+  std::vector<float> in(TailBlock),out(TailBlock);
+
+  for (int b=0;b<48000/TailBlock;++b) {
+    for (int i=0;i<TailBlock;++i) {
+      in[i]=rand()/float(RAND_MAX)-0.5f;
+    }
+    f.filter(in.data(),out.data(),TailBlock);
+  }
+
+  std::fill(in.begin(),in.end(),0.0f);
+  std::chrono::steady_clock::time_point t0=std::chrono::steady_clock::now();
+  for (int b=0;b<silentBlocks;++b) {
+    if (b==Blocks) {
+      early=since(t0);
+    }
+    if (b==silentBlocks-Blocks) {
+      t0=std::chrono::steady_clock::now();
+    }
+    f.filter(in.data(),out.data(),TailBlock);
+  }
+  late=since(t0);
+  sink=out[0];
+
+  const double scale=1.0e9/(double(Blocks)*TailBlock);
+  early*=scale;
+  late*=scale;
+}
+
+/**
+ * Adapter to the block interface of combFilter
+ */
+class combLoop {
+public:
+  combLoop() {
+    comb_.init(48000,60.0f,6.0f);
+  }
+
+  void filter(const float* in,float* out,const int n) {
+    comb_.filter(n,in,out);
+  }
+
+protected:
+  combFilter comb_;
+};
+
+/**
+ * Cost of the decaying tail of recursive filters once the input stops,
+ * with and without flushing subnormal values
+ */
+static void denormalTail() {
+  // the loop needs about 5.6M samples to decay into the subnormal range
+  const int silentBlocks=8000;
+  double early,late;
+
+  printf("Decaying tail after the input stops (ns per sample)\n");
+  printf("%-32s %10s %10s\n","","early","late");
+
+#ifdef __SSE__
+  const unsigned int csr=_mm_getcsr();
+  _mm_setcsr(csr & ~0x8040u);
+#endif
+
+  feedbackLoop plain(false);
+  tailCost(plain,silentBlocks,early,late);
+  printf("%-32s %10.3f %10.3f\n","loop, no flush",early,late);
+
+  feedbackLoop guarded(true);
+  tailCost(guarded,silentBlocks,early,late);
+  printf("%-32s %10.3f %10.3f\n","loop, flushDenormal()",early,late);
+
+  combLoop comb;
+  tailCost(comb,silentBlocks,early,late);
+  printf("%-32s %10.3f %10.3f\n","combFilter",early,late);
+
+  simd::disableDenormals();
+  feedbackLoop ftz(false);
+  tailCost(ftz,silentBlocks,early,late);
+  printf("%-32s %10.3f %10.3f\n","loop, disableDenormals()",early,late);
+
+#ifdef __SSE__
+  _mm_setcsr(csr);
+#endif
+  printf("\n");
+}
+
+/**
+ * Overlap-save filter with the former memory layout of freqFilter:
+ * interleaved fftwf_complex spectra of HwSize bins, and separate input and
+ * output arrays of HwSize samples, i.e. 6*HwSize floats per block.
+ */
+class interleavedFilter {
+public:
+  interleavedFilter(const int blockSize,
+                    const float* hn,const int hnSize,const int HwSize)
+    : blockSize_(blockSize),hnSize_(hnSize),HwSize_(HwSize) {
+    Hw_ = reinterpret_cast<fftwf_complex*>
+          (fftwf_malloc(sizeof(fftwf_complex)*HwSize_));
+    Xw_ = reinterpret_cast<fftwf_complex*>
+          (fftwf_malloc(sizeof(fftwf_complex)*HwSize_));
+    xn_ = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*HwSize_));
+    yn_ = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)*HwSize_));
+
+    fft_  = fftwf_plan_dft_r2c_1d(HwSize_,xn_,Xw_,FFTW_MEASURE);
+    ifft_ = fftwf_plan_dft_c2r_1d(HwSize_,Xw_,yn_,FFTW_MEASURE);
+
+    memset(xn_,0,sizeof(float)*HwSize_);
+    memcpy(xn_,hn,sizeof(float)*hnSize_);
+    fftwf_execute(fft_);
+
+    // the normalization of the inverse transform goes into the filter
+    memset(Hw_,0,sizeof(fftwf_complex)*HwSize_);
+    for (int k=0;k<HwSize_/2+1;++k) {
+      Hw_[k][0]=Xw_[k][0]/HwSize_;
+      Hw_[k][1]=Xw_[k][1]/HwSize_;
+    }
+    memset(xn_,0,sizeof(float)*HwSize_);
+  }
+
+  ~interleavedFilter() {
+    fftwf_destroy_plan(fft_);
+    fftwf_destroy_plan(ifft_);
+    fftwf_free(Hw_);
+    fftwf_free(Xw_);
+    fftwf_free(xn_);
+    fftwf_free(yn_);
+  }
+
+  void filter(const float* in,float* out) {
+    memmove(xn_,xn_+blockSize_,(hnSize_-1)*sizeof(float));
+    memcpy(xn_+hnSize_-1,in,blockSize_*sizeof(float));
+
+    fftwf_execute(fft_);
+    for (int k=0;k<HwSize_;++k) {
+      const float re=Xw_[k][0]*Hw_[k][0]-Xw_[k][1]*Hw_[k][1];
+      const float im=Xw_[k][0]*Hw_[k][1]+Xw_[k][1]*Hw_[k][0];
+      Xw_[k][0]=re;
+      Xw_[k][1]=im;
+    }
+    fftwf_execute(ifft_);
+
+    memcpy(out,yn_+hnSize_-1,blockSize_*sizeof(float));
+  }
+
+protected:
+  int blockSize_;
+  int hnSize_;
+  int HwSize_;
+  fftwf_plan fft_;
+  fftwf_plan ifft_;
+  fftwf_complex* Hw_;
+  fftwf_complex* Xw_;
+  float* xn_;
+  float* yn_;
+};
+
+/**
+ * Hardware cache event counter of the calling thread, user space only.
+ * If the kernel or the processor do not provide it, valid() is false.
+ */
+class cacheCounter {
+public:
+  cacheCounter(const int cache) : fd_(-1) {
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr,0,sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = cache |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = int(syscall(__NR_perf_event_open,&attr,0,-1,-1,0));
+#else
+    (void)cache;
+#endif
+  }
+
+  ~cacheCounter() {
+#ifdef __linux__
+    if (fd_>=0) {
+      close(fd_);
+    }
+#endif
+  }
+
+  bool valid() const {
+    return fd_>=0;
+  }
+
+  void start() {
+#ifdef __linux__
+    if (fd_>=0) {
+      ioctl(fd_,PERF_EVENT_IOC_RESET,0);
+      ioctl(fd_,PERF_EVENT_IOC_ENABLE,0);
+    }
+#endif
+  }
+
+  /**
+   * Stop counting and return the number of events since start()
+   */
+  long long stop() {
+    long long count=0;
+#ifdef __linux__
+    if (fd_>=0) {
+      ioctl(fd_,PERF_EVENT_IOC_DISABLE,0);
+      if (read(fd_,&count,sizeof(count))!=sizeof(count)) {
+        count=0;
+      }
+    }
+#endif
+    return count;
+  }
+
+protected:
+  int fd_;
+};
+
+/**
+ * Filters run round-robin in the footprint measurements, as the stages and
+ * channels of the application do, so that each one finds the cache filled
+ * by the others
+ */
+static const int Filters=8;
+
+/**
+ * Time and cache misses per block of Filters filters F, each one filtering
+ * one block in turn
+ */
+template<class F>
+static void filterCost(std::vector<F*>& f,const int blockSize,const int reps,
+                       double& ns,double& l1,double& ll) {
+  std::vector<float> in(blockSize),out(blockSize);
+  for (int i=0;i<blockSize;++i) {
+    in[i]=rand()/float(RAND_MAX)-0.5f;
+  }
+
+  // warm up
+  for (size_t k=0;k<f.size();++k) {
+    f[k]->filter(in.data(),out.data());
+  }
+
+  cacheCounter l1d(PERF_COUNT_HW_CACHE_L1D),llc(PERF_COUNT_HW_CACHE_LL);
+  l1d.start();
+  llc.start();
+  std::chrono::steady_clock::time_point t0=std::chrono::steady_clock::now();
+  for (int r=0;r<reps;++r) {
+    for (size_t k=0;k<f.size();++k) {
+      f[k]->filter(in.data(),out.data());
+    }
+  }
+  const double t=since(t0);
+  const long long m1=l1d.stop();
+  const long long mll=llc.stop();
+  sink=out[0];
+
+  const double blocks=double(reps)*f.size();
+  ns=t*1.0e9/blocks;
+  l1=l1d.valid() ? m1/blocks : -1.0;
+  ll=llc.valid() ? mll/blocks : -1.0;
+}
+
+/**
+ * Print a count, or n/a if the counter is not available
+ */
+static void printCount(const double c) {
+  if (c<0.0) {
+    printf(" %10s","n/a");
+  } else {
+    printf(" %10.1f",c);
+  }
+}
+
+/**
+ * Memory footprint of freqFilter compared to the former layout, with the
+ * proportions of the equalizer (impulse response of 3/8 and block of 1/2
+ * of HwSize), and the cache misses per block of both
+ */
+static void filterFootprint() {
+  printf("Frequency domain filter, %d filters round-robin (per block)\n",
+         Filters);
+  printf("%8s %-12s %10s %10s %10s %10s %10s\n",
+         "HwSize","layout","KiB","ns","L1D miss","LL miss","max diff");
+
+  for (int HwSize=512;HwSize<=16384;HwSize*=2) {
+    const int hnSize=HwSize*3/8;
+    const int blockSize=HwSize/2;
+    const int reps=std::max(1,(1<<22)/(HwSize*Filters));
+
+    std::vector<float> hn(hnSize);
+    for (int i=0;i<hnSize;++i) {
+      hn[i]=(rand()/float(RAND_MAX)-0.5f)/HwSize;
+    }
+
+    std::vector<interleavedFilter*> oldf;
+    std::vector<freqFilter*> newf;
+    for (int k=0;k<Filters;++k) {
+      oldf.push_back(new interleavedFilter(blockSize,hn.data(),hnSize,HwSize));
+      newf.push_back(new freqFilter(blockSize));
+      newf.back()->setFilter(hn.data(),hnSize,HwSize);
+    }
+
+    // both layouts have to compute the same output
+    float maxDiff=0.0f;
+    std::vector<float> in(blockSize),outOld(blockSize),outNew(blockSize);
+    for (int b=0;b<4;++b) {
+      for (int i=0;i<blockSize;++i) {
+        in[i]=rand()/float(RAND_MAX)-0.5f;
+      }
+      oldf[0]->filter(in.data(),outOld.data());
+      newf[0]->filter(in.data(),outNew.data());
+      for (int i=0;i<blockSize;++i) {
+        maxDiff=std::max(maxDiff,std::abs(outOld[i]-outNew[i]));
+      }
+    }
+
+    double ns,l1,ll;
+    filterCost(oldf,blockSize,reps,ns,l1,ll);
+    printf("%8d %-12s %10.1f %10.0f",HwSize,"interleaved",
+           6.0*HwSize*sizeof(float)/1024.0,ns);
+    printCount(l1);
+    printCount(ll);
+    printf("\n");
+
+    filterCost(newf,blockSize,reps,ns,l1,ll);
+    printf("%8d %-12s %10.1f %10.0f",HwSize,"split",
+           (2.5*HwSize+hnSize)*sizeof(float)/1024.0,ns);
+    printCount(l1);
+    printCount(ll);
+    printf(" %10.2g\n",maxDiff);
+
+    for (int k=0;k<Filters;++k) {
+      delete oldf[k];
+      delete newf[k];
+    }
+  }
+  printf("\n");
+}
+
+int main() {
+  splitVsInterleaved();
+  denormalTail();
+  filterFootprint();
+  return EXIT_SUCCESS;
+}
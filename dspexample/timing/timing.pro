@@ -0,0 +1,34 @@
+# -------------------------------------------------
+# Standalone timing of the processing kernels.
+# It is not part of the application.
+# -------------------------------------------------
+QT -= core \
+    gui
+CONFIG += console
+CONFIG -= app_bundle
+TARGET = timing
+TEMPLATE = app
+INCLUDEPATH += ..
+QMAKE_CXXFLAGS += -std=c++14
+LIBS += -lfftw3f
+# The default build runs on any x86-64 processor.  The AVX2 and F16C
+# kernels are enabled with "qmake CONFIG+=avx2", or with everything the
+# build host supports with "qmake CONFIG+=native" (such a binary may not
+# run on other processors).
+avx2 {
+    QMAKE_CXXFLAGS += -msse4.1 \
+        -mavx2 \
+        -mf16c
+}
+native {
+    QMAKE_CXXFLAGS += -march=native
+}
+SOURCES += timing.cpp \
+    ../combfilter.cpp \
+    ../freqFilter.cpp \
+    ../simd.cpp
+HEADERS += ../simd.h \
+    ../combfilter.h \
+    ../freqFilter.h \
+    ../smallfft.h \
+    ../fracdelay.h